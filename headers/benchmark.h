@@ -0,0 +1,175 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <stdio.h>
+#include "cloth.h"
+
+// Set associative cache with LRU replacement, counts the misses of a replayed address stream.
+// Used instead of hardware counters so the numbers are the same on every machine.
+class CacheSimulator
+{
+public:
+	long long Accesses = 0;
+	long long Misses = 0;
+
+	CacheSimulator(int sizeBytes, int ways, int lineBytes = 64) : Ways(ways), LineBytes(lineBytes)
+	{
+		Sets = sizeBytes / (ways * lineBytes);
+		Tags.assign(Sets * Ways, -1);
+		LastUse.assign(Sets * Ways, 0);
+	}
+
+	// every cache line of [address, address + bytes) is accessed once
+	void access(const void* address, size_t bytes)
+	{
+		long long first = (long long)(size_t)address / LineBytes, last = ((long long)(size_t)address + (long long)bytes - 1) / LineBytes;
+		for (long long line = first; line <= last; line++) accessLine(line);
+	}
+
+	void resetCount() { Accesses = 0; Misses = 0; }
+
+private:
+	int Sets, Ways, LineBytes;
+	std::vector<long long> Tags;
+	std::vector<long long> LastUse;
+	long long Clock = 0;
+
+	void accessLine(long long line)
+	{
+		Accesses++;
+		Clock++;
+		int set = (int)(line % Sets), oldest = set * Ways;
+		for (int way = set * Ways; way < (set + 1) * Ways; way++)
+		{
+			if (Tags[way] == line) { LastUse[way] = Clock; return; }
+			if (LastUse[way] < LastUse[oldest]) oldest = way;
+		}
+		Misses++;
+		Tags[oldest] = line;
+		LastUse[oldest] = Clock;
+	}
+};
+
+// Replay the memory accesses of one constraint sweep: the constraint record, then Position and InvMass of both nodes.
+// The first sweep warms the caches, the second one is counted. L1 and L2 both see the whole stream.
+void replayConstraintSweep(Cloth& cloth, CacheSimulator& l1, CacheSimulator& l2)
+{
+	const size_t NODE_BYTES = sizeof(glm::vec<3, GLdouble>) + sizeof(GLdouble);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		l1.resetCount();
+		l2.resetCount();
+		for (Constraint& constraint : cloth.Constraints)
+		{
+			const void* addresses[3] = { &constraint, &cloth.NodeStorage[constraint.GetNode1()].Position, &cloth.NodeStorage[constraint.GetNode2()].Position };
+			size_t bytes[3] = { sizeof(Constraint), NODE_BYTES, NODE_BYTES };
+			for (int k = 0; k < 3; k++)
+			{
+				l1.access(addresses[k], bytes[k]);
+				l2.access(addresses[k], bytes[k]);
+			}
+		}
+	}
+}
+
+// --benchmark: every method runs once with the row order and fully shuffled constraints, once with the locality
+// order (Cloth::initNodeOrder and Cloth::orderConstraints), on a larger cloth than the default one.
+// Reports the time per frame, the simulated cache misses per constraint of one sweep and the convergence after
+// all frames, which should stay about the same for both orders.
+void RunLocalityBenchmark(int nodesInSide = 128, int frames = 120)
+{
+	std::vector<MethodClass> methods = { M_PPBD, M_PPBD_Chebyshev, M_PPBD_Jacobi, M_PPBD_SS, M_Vertex_Block_Descent };
+	std::vector<std::string> lines;
+	for (MethodClass method : methods)
+	{
+		for (bool locality : { false, true })
+		{
+			method.MethodClothNodesNumber = glm::vec2(nodesInSide, nodesInSide);
+			method.setLocalityOrder(locality);
+			Cloth cloth(glm::vec3(-8, 9, -4), glm::vec2(16, 16), method);
+			cloth.UpdateVelocity(VEL_BACK, Cloth::DEFAULT_FORCE * 0.02);
+
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			for (int frame = 0; frame < frames; frame++) cloth.Step(1.0 / 60.0);
+			double frameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / frames;
+
+			// node based solvers don't sweep the constraints, only their time is compared
+			char misses[64] = "         -          -";
+			if (method.isPositionBased())
+			{
+				CacheSimulator l1(32 * 1024, 8), l2(1024 * 1024, 16);
+				replayConstraintSweep(cloth, l1, l2);
+				double count = std::max<double>(1.0, (double)cloth.Constraints.size());
+				snprintf(misses, sizeof(misses), "%10.3f %10.3f", l1.Misses / count, l2.Misses / count);
+			}
+
+			char line[256];
+			snprintf(line, sizeof(line), "%-22s %-9s %9.2f %s %10.2e %9.3f%%", method.getName().c_str(), locality ? "locality" : "row",
+				frameTime, misses, cloth.Stats.RmsResidual, 100.0 * cloth.getStretchError());
+			lines.push_back(line);
+		}
+	}
+	printf("\n%d x %d nodes, %d frames, misses of one constraint sweep (L1 32 KiB 8 way, L2 1 MiB 16 way, 64 B lines)\n",
+		nodesInSide, nodesInSide, frames);
+	printf("%-22s %-9s %9s %10s %10s %10s %10s\n", "method", "order", "ms/frame", "L1 miss/c", "L2 miss/c", "rms", "stretch");
+	for (std::string& line : lines) printf("%s\n", line.c_str());
+}
+
+// value of a counter scaled to one frame, "-" if it isn't available
+std::string formatCounter(long long value, double scale, const char* format = "%11.4g")
+{
+	char text[32] = "          -";
+	if (value >= 0) snprintf(text, sizeof(text), format, value * scale);
+	return text;
+}
+
+// --benchmark counters: hardware counters of every phase of Cloth::Step (the TRACE_SCOPEs of cloth.h) per method
+// and grid size, per frame. Phases nest, "Cloth::Step" contains all the others. Only the main thread is counted,
+// so with worker threads the parallel sweeps show its share alone; the cache misses and IPC of a layout are
+// compared best with one thread. Counters the machine doesn't have, e.g. in most virtual machines, show "-".
+void RunCounterBenchmark(int frames = 60)
+{
+	std::vector<MethodClass> methods = { M_PPBD, M_PBD, M_PPBD_SS, M_PPBD_Jacobi, M_Implicit_Euler, M_Projective_Dynamics, M_Vertex_Block_Descent };
+	std::vector<int> sizes = { 32, 64, 128 };
+	if (!perfPhases.start())
+	{
+		printf("No perf_event counter could be opened, see /proc/sys/kernel/perf_event_paranoid\n");
+		return;
+	}
+	printf("\n%d frames, values per frame, counters of the main thread only\n", frames);
+	if (threadPool.getThreadCount() > 1)
+		printf("%d worker threads aren't counted, run with --threads 1 to count every parallel sweep\n", threadPool.getThreadCount() - 1);
+	for (int c = 0; c < PERF_COUNTER_NUMBER; c++)
+		if (!perfPhases.Counters.isAvailable(c)) printf("%s not available\n", PerfCounters::getName(c));
+	for (MethodClass method : methods)
+	{
+		for (int nodesInSide : sizes)
+		{
+			method.MethodClothNodesNumber = glm::vec2(nodesInSide, nodesInSide);
+			Cloth cloth(glm::vec3(-8, 9, -4), glm::vec2(16, 16), method);
+			cloth.UpdateVelocity(VEL_BACK, Cloth::DEFAULT_FORCE * 0.02);
+			cloth.Step(1.0 / 60.0); // warm up, the first frame allocates the solver buffers
+
+			perfPhases.Phases.clear();
+			for (int frame = 0; frame < frames; frame++) cloth.Step(1.0 / 60.0);
+
+			printf("\n%s, %d x %d nodes, %zu constraints\n", method.getName().c_str(), nodesInSide, nodesInSide, cloth.Constraints.size());
+			printf("%-22s %7s %11s %11s %11s %6s %11s %11s %11s %11s\n", "phase", "calls", "ms", "cycles", "instr.", "IPC",
+				"L1D misses", "LLC misses", "br. misses", "page faults");
+			for (std::pair<const std::string, PerfPhaseCounter::Phase>& phase : perfPhases.Phases)
+			{
+				const long long* value = phase.second.Value;
+				char ipc[16] = "     -";
+				if (value[PERF_CYCLES] > 0 && value[PERF_INSTRUCTIONS] >= 0)
+					snprintf(ipc, sizeof(ipc), "%6.2f", (double)value[PERF_INSTRUCTIONS] / value[PERF_CYCLES]);
+				double perFrame = 1.0 / frames;
+				printf("%-22s %7.1f %s %s %s %s %s %s %s %s\n", phase.first.c_str(), phase.second.Calls * perFrame,
+					formatCounter(value[PERF_TASK_CLOCK], perFrame * 1.0e-6, "%11.3f").c_str(),
+					formatCounter(value[PERF_CYCLES], perFrame).c_str(), formatCounter(value[PERF_INSTRUCTIONS], perFrame).c_str(), ipc,
+					formatCounter(value[PERF_L1D_MISSES], perFrame).c_str(), formatCounter(value[PERF_LLC_MISSES], perFrame).c_str(),
+					formatCounter(value[PERF_BRANCH_MISSES], perFrame).c_str(), formatCounter(value[PERF_PAGE_FAULTS], perFrame).c_str());
+			}
+		}
+	}
+	perfPhases.stop();
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "node.h"
+#include "method.h"
+
+// Isometric bending (Bergou et al. 2006) for PBD, XPBD and XPBD_SS.
+// Two triangles share the edge (x0, x1), x2 and x3 are their opposite nodes. For a cloth that is flat
+// at rest the bending energy of the pair is 3 / (2 * (A0 + A1)) * |sum_j K_j x_j|^2, where K only
+// depends on the cotangents of the rest angles. It is zero for every isometric deformation, so
+// bending doesn't fight stretching, and since it is quadratic it is solved exactly as the linear
+// vector constraint C(x) = sum_j Weight_j x_j = 0 with Weight = sqrt(3 / (A0 + A1)) * K.
+class IsometricBending
+{
+private:
+	Node* Nodes[4];       // x0, x1 on the shared edge, x2, x3 opposite
+	GLdouble Weight[4];   // fixed at rest, the constraint gradient of node j is Weight[j] * I
+	GLdouble Stiffness;   // for PBD (0.0f - 1.0f)
+	GLdouble Compliance;  // for XPBD
+	glm::vec<3, GLdouble> Lambda; // for XPBD
+	glm::vec<3, GLdouble> RestValue; // C at rest, 0 for the flat cloth except while Cloth::Resample blends
+
+	static GLdouble cotangent(glm::vec<3, GLdouble> u, glm::vec<3, GLdouble> v)
+	{
+		return glm::dot(u, v) / glm::length(glm::cross(u, v));
+	}
+
+public:
+	IsometricBending(Node* edge0, Node* edge1, Node* opposite0, Node* opposite1, GLdouble compliance) :
+		Stiffness(0.2f), Compliance(compliance), Lambda(0.0, 0.0, 0.0), RestValue(0.0, 0.0, 0.0)
+	{
+		Nodes[0] = edge0;
+		Nodes[1] = edge1;
+		Nodes[2] = opposite0;
+		Nodes[3] = opposite1;
+		glm::vec<3, GLdouble> x0 = edge0->Position, x1 = edge1->Position, x2 = opposite0->Position, x3 = opposite1->Position;
+		glm::vec<3, GLdouble> edge = x1 - x0;
+		// angles at x0 and x1 in the triangle of x2 and in the triangle of x3
+		GLdouble cot02 = cotangent(edge, x2 - x0), cot03 = cotangent(edge, x3 - x0);
+		GLdouble cot12 = cotangent(-edge, x2 - x1), cot13 = cotangent(-edge, x3 - x1);
+		GLdouble area = 0.5 * (glm::length(glm::cross(edge, x2 - x0)) + glm::length(glm::cross(edge, x3 - x0)));
+		GLdouble scale = std::sqrt(3.0 / area);
+		Weight[0] = scale * (cot12 + cot13);
+		Weight[1] = scale * (cot02 + cot03);
+		Weight[2] = -scale * (cot02 + cot12);
+		Weight[3] = -scale * (cot03 + cot13);
+	}
+
+	void SetLambda(GLdouble val) { Lambda = glm::vec<3, GLdouble>(val, val, val); }
+
+	glm::vec<3, GLdouble> GetRestValue() { return RestValue; }
+	void SetRestValue(glm::vec<3, GLdouble> value) { RestValue = value; }
+	glm::vec<3, GLdouble> GetCurrentValue()
+	{
+		glm::vec<3, GLdouble> value(0.0, 0.0, 0.0);
+		for (int j = 0; j < 4; j++) value += Weight[j] * Nodes[j]->Position;
+		return value;
+	}
+
+	// Gauss-Seidel projection, omega scales the correction (successive over-relaxation).
+	// Returns |C(x)| before the correction.
+	template<MethodEnum Method>
+	GLdouble Solve(GLdouble dt, GLdouble omega = 1.0)
+	{
+		static_assert(Method == XPBD || Method == PBD || Method == XPBD_SS, "bending is solved by PBD, XPBD and XPBD_SS only");
+		glm::vec<3, GLdouble> constraint = -RestValue;
+		GLdouble weightSum = 0.0; // sum_j w_j |grad_j C|^2
+		for (int j = 0; j < 4; j++)
+		{
+			constraint += Weight[j] * Nodes[j]->Position;
+			weightSum += Nodes[j]->InvMass * Weight[j] * Weight[j];
+		}
+		if (weightSum == 0.0) return 0.0;
+		glm::vec<3, GLdouble> deltaLambda;
+		GLdouble alpha = Compliance / (dt * dt);
+		if constexpr (Method == XPBD)
+		{
+			deltaLambda = omega * (-constraint - alpha * Lambda) / (weightSum + alpha);
+			Lambda += deltaLambda;
+		}
+		else if constexpr (Method == PBD)
+			deltaLambda = omega * Stiffness * -constraint / weightSum;
+		else
+			deltaLambda = omega * -constraint / (weightSum + alpha);
+		for (int j = 0; j < 4; j++)
+			Nodes[j]->Position += Nodes[j]->InvMass * Weight[j] * deltaLambda;
+		return glm::length(constraint);
+	}
+};
@@ -1,11 +1,18 @@
 #pragma once
 #include <vector>
+#include <cmath>
 #include <stdio.h>
 #include <iostream>
 #include <random>
+#include <map>
 #include "node.h"
 #include "spring.h"
 #include "constraint.h"
+#include "bending.h"
+#include "membrane.h"
+#include "hierarchy.h"
+#include "stats.h"
+#include "sparse.h"
 #include "method.h"
 
 enum VelocityUpdate
@@ -18,24 +25,58 @@ enum VelocityUpdate
 	VEL_RIGHT_AND_UP
 };
 
+// Coefficients of a cloth, the defaults are the ones every cloth used before scene files (see config.h)
+struct ClothMaterial
+{
+	GLdouble InvMass = 1.0;
+	GLdouble DistanceCompliance = 0.0;
+	GLdouble BendingCompliance = 1.0;
+	// strain membrane, per unit area: warp is the width direction and weft the height direction of the cloth
+	GLdouble WarpCompliance = 0.0;
+	GLdouble WeftCompliance = 0.0;
+	GLdouble ShearCompliance = 1.0e-4;
+	GLdouble IsometricBendingCompliance = 50.0; // about as soft as all distance bending constraints (ConstraintLevel 3)
+	glm::vec<3, GLdouble> Gravity = glm::vec<3, GLdouble>(0.0, -10.0, 0.0);
+	// springs of the mass-spring methods
+	double StructureCoef = 1000.0;
+	double ShearCoef = 50.0;
+	double BendingCoef = 400.0;
+	// pinned nodes (w, h) of the cloth's own grid (MethodClass::MethodClothNodesNumber), negative values count from the
+	// last column or row, so (-1, 0) is the top right corner. A level of detail grid of another resolution pins the node
+	// nearest to the same point of the cloth.
+	std::vector<glm::ivec2> Pins = { glm::ivec2(0, 0), glm::ivec2(-1, 0) };
+
+	static bool isInGrid(glm::ivec2 pin, glm::ivec2 grid) { return pin.x >= -grid.x && pin.x < grid.x && pin.y >= -grid.y && pin.y < grid.y; }
+
+	bool isPinned(int w, int h, int nodesInWidth, int nodesInHeight, glm::ivec2 grid)
+	{
+		for (glm::ivec2& pin : Pins)
+		{
+			glm::ivec2 node(pin.x < 0 ? grid.x + pin.x : pin.x, pin.y < 0 ? grid.y + pin.y : pin.y);
+			int pinW = (int)std::lround((GLdouble)node.x / (grid.x - 1) * (nodesInWidth - 1));
+			int pinH = (int)std::lround((GLdouble)node.y / (grid.y - 1) * (nodesInHeight - 1));
+			if (pinW == w && pinH == h) return true;
+		}
+		return false;
+	}
+};
+
 class Cloth
 {
 private:
-	const GLdouble DEFAULT_INVMASS = 1.0;
-	const GLdouble DISTANCE_COMPLIANCE = 0.0;
-	const GLdouble BENDING_COMPLIANCE = 1.0;
-	const glm::vec<3, GLdouble> gravity = glm::vec<3, GLdouble>(0.0, -10.0, 0.0);
-	const double STRUCTURE_COEF = 1000.0;
-	const double SHEAR_COEF = 50.0;
-	const double BENDING_COEF = 400.0;
+	// The explicit spring methods apply gravity / Iteration per step, Implicit_Euler applies full gravity once per frame.
+	// Its springs are scaled so the cloth rests at the same sag as with 40 explicit iterations.
+	const double IMPLICIT_STIFFNESS_SCALE = 40.0;
+	const int CONSTRAINT_BLOCK = 64; // constraints kept together by orderConstraints
 public:
 	int Iteration;
 	glm::vec<3, GLdouble> ClothPosition;
 	int Width, Height;
 	int NodesInWidth, NodesInHeight;
 	MethodClass Method;
-	const GLdouble DEFAULT_FORCE = 5.0; // used in velocity update with keyboard
+	static constexpr GLdouble DEFAULT_FORCE = 5.0; // used in velocity update with keyboard
 	int ConstraintLevel;
+	ClothMaterial Material;
 
 	enum DrawModeEnum
 	{
@@ -45,13 +86,24 @@ public:
 	};
 	DrawModeEnum drawMode = DRAW_FACES;
 
-	std::vector<Node*> Nodes;
+	std::vector<Node*> Nodes; // Nodes[i] is &NodeStorage[i]
+	std::vector<Node> NodeStorage; // all nodes in one block, the constraints index into it
+	std::vector<int> NodeSlot; // position in Nodes of the grid node h * NodesInWidth + w, see initNodeOrder
 	std::vector<Constraint> Constraints; // for PBD & XPBD
+	std::vector<int> StretchConstraints; // indices into Constraints of the grid edges and quad diagonals, the rest is bending
+	MembraneTriangles Membrane; // only built if Method.Membrane is MEMBRANE_STRAIN, replaces the distance constraints
+	std::vector<IsometricBending> Bendings; // only built if Method.Bending is BENDING_ISOMETRIC
+	std::vector<Tether> Tethers; // only built if Method.UseTethers, at most one per free node
+	ConstraintHierarchy Hierarchy; // coarse levels of Constraints, only built if Method.HierarchyLevels > 0
+	SolverStats Stats; // convergence of the last frame
 	std::vector<Spring*> Springs; // for mass-spring system
+	BlockCSRMatrix SystemMatrix; // for Implicit_Euler, structure built from Springs
+	SkylineCholesky SystemFactor; // for Projective_Dynamics, factored once per time step size
 	std::vector<Node*> Faces; // for rendering
+	std::vector<GLuint> FaceIndices; // Faces as grid indices h * NodesInWidth + w, for the element buffer of the renderer
 
 	Cloth() {}
-	Cloth(glm::vec3 position, glm::vec2 size, MethodClass method)
+	Cloth(glm::vec3 position, glm::vec2 size, MethodClass method, ClothMaterial material = ClothMaterial())
 	{
 		ClothPosition = position;
 		Width = size.x;
@@ -61,10 +113,11 @@ public:
 		Method = method;
 		Iteration = method.MethodIteration;
 		ConstraintLevel = method.ConstraintLevel;
+		Material = material;
 		init();
 	}
 	// just a dummy version of copy constructor
-	void set(glm::vec3 position, glm::vec2 size, MethodClass method)
+	void set(glm::vec3 position, glm::vec2 size, MethodClass method, ClothMaterial material = ClothMaterial())
 	{
 		ClothPosition = position;
 		Width = size.x;
@@ -74,6 +127,7 @@ public:
 		Method = method;
 		Iteration = method.MethodIteration;
 		ConstraintLevel = method.ConstraintLevel;
+		Material = material;
 		init();
 	}
 	~Cloth()
@@ -81,161 +135,162 @@ public:
 		Destroy();
 	}
 
-	Node* getNode(int w, int h) { return Nodes[h * NodesInWidth + w]; }
-	glm::vec3 computeFaceNormal(Node* n1, Node* n2, Node* n3)
+	Node* getNode(int w, int h) { return Nodes[NodeSlot[h * NodesInWidth + w]]; }
+	// Vertex normals for rendering, one per node in grid order. They are only computed when asked for
+	// after the cloth has moved, so frames that are simulated but never drawn don't pay for them.
+	std::vector<glm::vec3>& getNormals()
 	{
-		return glm::cross(n2->Position - n1->Position, n3->Position - n1->Position);
+		if (NormalsDirty) computeNormal();
+		return Normals;
 	}
 
-	void computeNormal()
+	// One frame of a method, see getIntegrators
+	typedef void (Cloth::*Integrator)(GLdouble dt);
+
+	// The integrator of every method. Method specific code is compiled per method (the solver kernels are
+	// templates on MethodEnum), so there is no switch on the method in any loop, only this lookup per frame.
+	// A new method only needs its integrator added here or registered with RegisterIntegrator.
+	static std::map<MethodEnum, Integrator>& getIntegrators()
 	{
-		/** Reset nodes' normal **/
-		glm::vec3 normal(0.0, 0.0, 0.0);
-		for (int i = 0; i < Nodes.size(); i++)
-			Nodes[i]->Normal = normal;
-		/** Compute normal of each face **/
-		for (int i = 0; i < Faces.size() / 3; i++)
+		static std::map<MethodEnum, Integrator> integrators =
 		{
-			// 3 nodes in each face
-			Node* n1 = Faces[3 * i + 0];
-			Node* n2 = Faces[3 * i + 1];
-			Node* n3 = Faces[3 * i + 2];
-
-			// Face normal
-			normal = computeFaceNormal(n1, n2, n3);
-			// Add all face normal
-			n1->Normal += normal;
-			n2->Normal += normal;
-			n3->Normal += normal;
-		}
-		for (int i = 0; i < Nodes.size(); i++)
-			Nodes[i]->Normal = glm::normalize(Nodes[i]->Normal);
+			{ XPBD, &Cloth::integratePositionBased<XPBD> },
+			{ PBD, &Cloth::integratePositionBased<PBD> },
+			{ XPBD_SS, &Cloth::integrateSmallSteps },
+			{ Verlet_Integration, &Cloth::integrateMassSpring<Verlet_Integration> },
+			{ Explicit_Euler, &Cloth::integrateMassSpring<Explicit_Euler> },
+			{ Semi_Implicit_Euler, &Cloth::integrateMassSpring<Semi_Implicit_Euler> },
+			{ Implicit_Euler, &Cloth::integrateImplicit },
+			{ Projective_Dynamics, &Cloth::integrateProjective },
+			{ Vertex_Block_Descent, &Cloth::integrateVertexBlockDescent }
+		};
+		return integrators;
 	}
+	static void RegisterIntegrator(MethodEnum method, Integrator integrator) { getIntegrators()[method] = integrator; }
 
 	void Integrate(GLdouble dt)
 	{
-		switch (Method.getId())
+		std::map<MethodEnum, Integrator>::iterator found = getIntegrators().find(Method.getId());
+		if (found != getIntegrators().end()) (this->*found->second)(dt);
+	}
+
+	// Advance the cloth by one frame
+	void Step(GLdouble dt)
+	{
+		TRACE_SCOPE("Cloth::Step");
+		Stats.reset();
+		if (RestBlendFrames > 0) blendRestLength();
+		Integrate(dt);
+		NormalsDirty = true;
+	}
+
+	// Rebuild the cloth with another grid resolution and carry its state over.
+	// Every new node samples position and velocity from the old grid at the same (u, v),
+	// which is a prolongation when refining and a restriction when coarsening.
+	void Resample(int nodesInWidth, int nodesInHeight)
+	{
+		if (nodesInWidth == NodesInWidth && nodesInHeight == NodesInHeight) return;
+		int oldWidth = NodesInWidth, oldHeight = NodesInHeight;
+		std::vector<glm::vec<3, GLdouble>> oldPosition(Nodes.size()), oldVelocity(Nodes.size()), oldOldPosition(Nodes.size());
+		for (int i = 0; i < Nodes.size(); i++)
 		{
-		case XPBD:
-		case PBD:
-			// n iterations
-			for (int i = 0; i < Nodes.size(); i++)
-			{
-				if (Nodes[i]->InvMass == 0.0)
-					continue;
-				Nodes[i]->Velocity += Nodes[i]->Acceleration * dt;
-				Nodes[i]->OldPosition = Nodes[i]->Position;
-				Nodes[i]->Position += Nodes[i]->Velocity * dt;
-			}
-			for (int i = 0; i < Constraints.size(); i++)
-				Constraints[i].SetLambda(0.0f);
-			for (int n = 0; n < Iteration; n++)
-			{
-				for (int i = 0; i < Constraints.size(); i++)
-				{
-					Constraints[i].Solve(dt, Method.getId());
-				}
-			}
-			for (int i = 0; i < Nodes.size(); i++)
-			{
-				if (Nodes[i]->InvMass == 0.0f)
-					continue;
-				Nodes[i]->Velocity = (Nodes[i]->Position - Nodes[i]->OldPosition) * 1.0 / dt;
-			}
-			break;
-		case XPBD_SS:
-			// only one iteration
-			for (int i = 0; i < Nodes.size(); i++)
-			{
-				if (Nodes[i]->InvMass == 0.0)
-					continue;
-				Nodes[i]->Velocity += Nodes[i]->Acceleration * dt;
-				Nodes[i]->OldPosition = Nodes[i]->Position;
-				Nodes[i]->Position += Nodes[i]->Velocity * dt;
-			}
-			for (int i = 0; i < Constraints.size(); i++)
-			{
-				Constraints[i].Solve(dt, Method.getId());
-			}
-			for (int i = 0; i < Nodes.size(); i++)
-			{
-				if (Nodes[i]->InvMass == 0.0f)
-					continue;
-				Nodes[i]->Velocity = (Nodes[i]->Position - Nodes[i]->OldPosition) * 1.0 / dt;
-			}
-			break;
-			// wait a minute.. it looks like Explicit Euler
-		case Verlet_Integration:
-		case Explicit_Euler:
-		case Semi_Implicit_Euler:
-			// n iterations
-			for (int iter = 0; iter < Iteration; iter++)
-			{
-				// compute force first
-				for (int i = 0; i < Nodes.size(); i++)
-				{
-					if (Nodes[i]->InvMass == 0.0) continue;
-					Nodes[i]->addForce(gravity * 1.0 / Nodes[i]->InvMass / (double)Iteration);
-				}
-				for (int i = 0; i < Springs.size(); i++)
-				{
-					Springs[i]->applyInternalForce(dt);
-				}
+			Node* node = Nodes[NodeSlot[i]]; // in grid order
+			oldPosition[i] = node->Position;
+			oldVelocity[i] = node->Velocity;
+			oldOldPosition[i] = node->OldPosition;
+		}
 
-				// update the position using integration
-				switch (Method.getId())
-				{
-				// Note: dt = 1/60 won't work with Explicit_Euler, will explode; but 1/600 works
-				case Explicit_Euler:
-					for (int i = 0; i < Nodes.size(); i++)
-					{
-						if (Nodes[i]->InvMass == 0.0) continue;
-						Nodes[i]->Acceleration = Nodes[i]->Force * Nodes[i]->InvMass;
-						glm::vec<3, double> temp = Nodes[i]->Velocity;
-						Nodes[i]->Velocity += Nodes[i]->Acceleration * dt;
-						Nodes[i]->Position += temp * dt;
-					}
-					break;
-				case Semi_Implicit_Euler:
-					for (int i = 0; i < Nodes.size(); i++)
-					{
-						if (Nodes[i]->InvMass == 0.0) continue;
-						Nodes[i]->Acceleration = Nodes[i]->Force * Nodes[i]->InvMass;
-						Nodes[i]->Velocity += Nodes[i]->Acceleration * dt;
-						Nodes[i]->Position += Nodes[i]->Velocity * dt;
-					}
-					break;
-				case Verlet_Integration:
-					for (int i = 0; i < Nodes.size(); i++)
-					{
-						if (Nodes[i]->InvMass == 0.0) continue;
-						glm::vec<3, double> temp = Nodes[i]->Position;
-						Nodes[i]->Acceleration = Nodes[i]->Force * Nodes[i]->InvMass;
-						Nodes[i]->Position += (Nodes[i]->Position - Nodes[i]->OldPosition) + Nodes[i]->Acceleration * dt * dt;
-						Nodes[i]->OldPosition = temp;
-					}
-					break;
-				}
-				// clear the force
-				for (int i = 0; i < Nodes.size(); i++)
+		Destroy();
+		NodesInWidth = nodesInWidth;
+		NodesInHeight = nodesInHeight;
+		init();
+
+		for (int w = 0; w < NodesInWidth; w++)
+		{
+			for (int h = 0; h < NodesInHeight; h++)
+			{
+				// continuous coordinate of this node in the old grid
+				GLdouble x = (GLdouble)w / (NodesInWidth - 1) * (oldWidth - 1);
+				GLdouble y = (GLdouble)h / (NodesInHeight - 1) * (oldHeight - 1);
+				int w0 = std::min((int)x, oldWidth - 2), h0 = std::min((int)y, oldHeight - 2);
+				GLdouble fx = x - w0, fy = y - h0;
+				int i00 = h0 * oldWidth + w0, i10 = i00 + 1, i01 = i00 + oldWidth, i11 = i01 + 1;
+				auto sample = [&](std::vector<glm::vec<3, GLdouble>>& field)
 				{
-					Nodes[i]->Force = glm::vec<3, double>(0, 0, 0);
-				}
+					return (field[i00] * (1.0 - fx) + field[i10] * fx) * (1.0 - fy) + (field[i01] * (1.0 - fx) + field[i11] * fx) * fy;
+				};
+				Node* node = getNode(w, h);
+				node->Position = sample(oldPosition);
+				node->OldPosition = sample(oldOldPosition);
+				if (node->InvMass != 0.0) node->Velocity = sample(oldVelocity);
 			}
-			break;
 		}
+		// The sampled shape is stretched and bent differently from what the new grid rests at, releasing that
+		// difference at once would make the cloth jump. So every constraint, spring, tether, membrane triangle and
+		// bending element starts at its sampled state and is blended to its real rest state over REST_BLEND_FRAMES frames.
+		RestLengthTarget.clear();
+		for (Constraint* constraint : getAllConstraints())
+		{
+			RestLengthTarget.push_back(constraint->GetRestLength());
+			constraint->SetRestLength(constraint->GetCurrentLength(NodeStorage.data()));
+		}
+		for (int i = 0; i < Springs.size(); i++)
+		{
+			RestLengthTarget.push_back(Springs[i]->RestLength);
+			Springs[i]->RestLength = glm::length(Springs[i]->Node2->Position - Springs[i]->Node1->Position);
+		}
+		for (int i = 0; i < Tethers.size(); i++)
+		{
+			// unilateral, only a tether the sampled shape overstretches has to start longer
+			RestLengthTarget.push_back(Tethers[i].GetMaxLength());
+			Tethers[i].SetMaxLength(std::max(Tethers[i].GetMaxLength(), Tethers[i].GetCurrentLength()));
+		}
+		Membrane.SetRestStrainToCurrent();
+		for (int i = 0; i < Bendings.size(); i++)
+			Bendings[i].SetRestValue(Bendings[i].GetCurrentValue());
+		RestBlendFrames = REST_BLEND_FRAMES;
+		NormalsDirty = true;
+	}
+
+	// Mean relative length error of the distance (non-bending) constraints, or mean strain of the membrane
+	GLdouble getStretchError()
+	{
+		if (Membrane.size() > 0) return Membrane.getStretchError();
+		GLdouble error = 0.0;
+		int count = 0;
+		for (int i : StretchConstraints)
+			error += std::abs(Constraints[i].GetCurrentLength(NodeStorage.data()) / Constraints[i].GetRestLength() - 1.0);
+		return StretchConstraints.empty() ? 0.0 : error / StretchConstraints.size();
+	}
+
+	// 1/2 m v^2 of the free nodes
+	GLdouble getKineticEnergy()
+	{
+		GLdouble energy = 0.0;
+		for (Node* node : Nodes)
+			if (node->InvMass != 0.0) energy += 0.5 * glm::dot(node->Velocity, node->Velocity) / node->InvMass;
+		return energy;
+	}
+
+	// -m g.x of the free nodes in world space
+	GLdouble getPotentialEnergy()
+	{
+		GLdouble energy = 0.0;
+		for (Node* node : Nodes)
+			if (node->InvMass != 0.0) energy -= glm::dot(Material.Gravity, getWorldPos(node)) / node->InvMass;
+		return energy;
 	}
 
 	glm::vec<3, GLdouble> getWorldPos(Node* n) { return ClothPosition + n->Position; }
-	void setWorldPos(Node* n, glm::vec<3, GLdouble> position) { n->Position = position - ClothPosition; }
-	void reset() { Destroy();  init(); }
+	void setWorldPos(Node* n, glm::vec<3, GLdouble> position) { n->Position = position - ClothPosition; NormalsDirty = true; }
+	void reset() { Destroy();  init(); RestBlendFrames = 0; }
 	void UpdateVelocity(VelocityUpdate update, GLdouble force = -1.0)
 	{
 		if (force < 0) force = DEFAULT_FORCE;
 		for (int i = 0; i < Nodes.size(); i++)
 		{
 			if (Nodes[i]->InvMass == 0) continue;
-			if (Method.getId() <= 3)
+			if (!Method.isMassSpring())
 			{
 				switch (update)
 				{
@@ -290,31 +345,662 @@ public:
 		}
 	}
 private:
-	void MakeConstraint(Node* n1, Node* n2, GLdouble compliance = 0.0f) { Constraints.push_back(Constraint(n1, n2, compliance)); }
+	/** for rendering **/
+	std::vector<glm::vec3> Normals; // see getNormals
+	std::vector<glm::vec3> GridPosition; // float positions in grid order, filled by computeNormal
+	bool NormalsDirty = true; // the nodes moved since the last computeNormal
+	/** end of for rendering **/
+
+	// Vertex normals into Normals, the area weighted sum of the normals of the faces around every node.
+	// The faces of initFaces around a node p form the ring E, S, SW, W, N, NE of its neighbours, and
+	// the normal of the face (p, a, b) is cross(a - p, b - p), so every node gathers its own normal from
+	// its neighbours: no scatter, rows run in parallel and the result goes straight to the render buffer.
+	void computeNormal()
+	{
+		TRACE_SCOPE("Cloth::computeNormal");
+		int n = NodesInWidth * NodesInHeight;
+		NormalsDirty = false;
+		Normals.resize(n);
+		GridPosition.resize(n);
+		threadPool.ParallelFor(0, NodesInHeight, [&](int h)
+		{
+			for (int w = 0; w < NodesInWidth; w++) GridPosition[h * NodesInWidth + w] = glm::vec3(getNode(w, h)->Position);
+		});
+		threadPool.ParallelFor(0, NodesInHeight, [&](int h)
+		{
+			bool innerRow = h > 0 && h < NodesInHeight - 1;
+			for (int w = 0; w < NodesInWidth; w++)
+			{
+				int i = h * NodesInWidth + w;
+				if (innerRow && w > 0 && w < NodesInWidth - 1)
+				{
+					// all 6 faces exist
+					glm::vec3 p = GridPosition[i];
+					glm::vec3 e = GridPosition[i + 1] - p, s = GridPosition[i + NodesInWidth] - p, sw = GridPosition[i + NodesInWidth - 1] - p;
+					glm::vec3 west = GridPosition[i - 1] - p, north = GridPosition[i - NodesInWidth] - p, ne = GridPosition[i - NodesInWidth + 1] - p;
+					Normals[i] = glm::normalize(glm::cross(e, s) + glm::cross(s, sw) + glm::cross(sw, west)
+						+ glm::cross(west, north) + glm::cross(north, ne) + glm::cross(ne, e));
+				}
+				else Normals[i] = computeBorderNormal(w, h);
+			}
+		});
+	}
+
+	// computeNormal for a node on the border, only the faces whose two ring neighbours exist
+	glm::vec3 computeBorderNormal(int w, int h)
+	{
+		const int RING_W[6] = { 1, 0, -1, -1, 0, 1 }, RING_H[6] = { 0, 1, 1, 0, -1, -1 };
+		glm::vec3 center = GridPosition[h * NodesInWidth + w], edge[6];
+		bool inside[6];
+		for (int k = 0; k < 6; k++)
+		{
+			int nw = w + RING_W[k], nh = h + RING_H[k];
+			inside[k] = nw >= 0 && nw < NodesInWidth && nh >= 0 && nh < NodesInHeight;
+			edge[k] = inside[k] ? GridPosition[nh * NodesInWidth + nw] - center : glm::vec3(0.0f);
+		}
+		glm::vec3 normal(0.0f);
+		for (int k = 0; k < 6; k++)
+			if (inside[k] && inside[(k + 1) % 6]) normal += glm::cross(edge[k], edge[(k + 1) % 6]);
+		return glm::normalize(normal);
+	}
+
+	/** for resolution switching **/
+	const int REST_BLEND_FRAMES = 30;
+	int RestBlendFrames = 0;
+	std::vector<GLdouble> RestLengthTarget; // constraints first (see getAllConstraints), then springs, then tethers
+	/** end of for resolution switching **/
+
+	void blendRestLength()
+	{
+		GLdouble keep = (RestBlendFrames - 1.0) / RestBlendFrames;
+		std::vector<Constraint*> constraints = getAllConstraints();
+		for (int i = 0; i < constraints.size(); i++)
+		{
+			GLdouble target = RestLengthTarget[i];
+			constraints[i]->SetRestLength(target + (constraints[i]->GetRestLength() - target) * keep);
+		}
+		for (int i = 0; i < Springs.size(); i++)
+		{
+			GLdouble target = RestLengthTarget[constraints.size() + i];
+			Springs[i]->RestLength = target + (Springs[i]->RestLength - target) * keep;
+		}
+		for (int i = 0; i < Tethers.size(); i++)
+		{
+			GLdouble target = RestLengthTarget[constraints.size() + Springs.size() + i];
+			Tethers[i].SetMaxLength(target + (Tethers[i].GetMaxLength() - target) * keep);
+		}
+		// the membrane rests at (1, 1, 0) and bending at 0
+		Membrane.BlendRestStrain(keep);
+		for (int i = 0; i < Bendings.size(); i++)
+			Bendings[i].SetRestValue(Bendings[i].GetRestValue() * keep);
+		RestBlendFrames--;
+	}
+
+	// XPBD and PBD: n iterations, XPBD_SS: one iteration of a small step
+	template<MethodEnum M>
+	void integratePositionBased(GLdouble dt)
+	{
+		{
+			TRACE_SCOPE("predict");
+			for (int i = 0; i < Nodes.size(); i++)
+			{
+				if (Nodes[i]->InvMass == 0.0)
+					continue;
+				Nodes[i]->Velocity += Nodes[i]->Acceleration * dt;
+				Nodes[i]->OldPosition = Nodes[i]->Position;
+				Nodes[i]->Position += Nodes[i]->Velocity * dt;
+			}
+		}
+		if constexpr (M == XPBD_SS)
+			solveConstraints<M>(dt, 1);
+		else
+		{
+			for (int i = 0; i < Constraints.size(); i++)
+				Constraints[i].SetLambda(0.0f);
+			for (int i = 0; i < Bendings.size(); i++)
+				Bendings[i].SetLambda(0.0f);
+			Membrane.ResetLambda();
+			if (Method.HierarchyLevels > 0)
+			{
+				TRACE_SCOPE("hierarchy");
+				GLdouble coarseIterations = (GLdouble)Hierarchy.Solve<M>(dt, Method) / std::max<size_t>(Constraints.size(), 1);
+				Stats.CoarseIterations += coarseIterations;
+				Stats.TotalCoarseIterations += coarseIterations;
+			}
+			solveConstraints<M>(dt, Iteration);
+		}
+		TRACE_SCOPE("update velocity");
+		for (int i = 0; i < Nodes.size(); i++)
+		{
+			if (Nodes[i]->InvMass == 0.0f)
+				continue;
+			Nodes[i]->Velocity = (Nodes[i]->Position - Nodes[i]->OldPosition) * 1.0 / dt;
+		}
+	}
+
+	// XPBD_SS splits the frame into Iteration small steps
+	void integrateSmallSteps(GLdouble dt)
+	{
+		for (int subStep = 0; subStep < Iteration; subStep++)
+			integratePositionBased<XPBD_SS>(dt / Iteration);
+	}
+
+	// wait a minute.. it looks like Explicit Euler
+	template<MethodEnum M>
+	void integrateMassSpring(GLdouble dt)
+	{
+		// n iterations
+		for (int iter = 0; iter < Iteration; iter++)
+		{
+			// compute force first
+			for (int i = 0; i < Nodes.size(); i++)
+			{
+				if (Nodes[i]->InvMass == 0.0) continue;
+				Nodes[i]->addForce(Material.Gravity * 1.0 / Nodes[i]->InvMass / (double)Iteration);
+			}
+			for (int i = 0; i < Springs.size(); i++)
+			{
+				Springs[i]->applyInternalForce(dt);
+			}
+
+			// update the position using integration
+			for (int i = 0; i < Nodes.size(); i++)
+			{
+				if (Nodes[i]->InvMass == 0.0) continue;
+				Nodes[i]->Acceleration = Nodes[i]->Force * Nodes[i]->InvMass;
+				if constexpr (M == Explicit_Euler)
+				{
+					// Note: dt = 1/60 won't work with Explicit_Euler, will explode; but 1/600 works
+					glm::vec<3, double> temp = Nodes[i]->Velocity;
+					Nodes[i]->Velocity += Nodes[i]->Acceleration * dt;
+					Nodes[i]->Position += temp * dt;
+				}
+				else if constexpr (M == Semi_Implicit_Euler)
+				{
+					Nodes[i]->Velocity += Nodes[i]->Acceleration * dt;
+					Nodes[i]->Position += Nodes[i]->Velocity * dt;
+				}
+				else // Verlet_Integration
+				{
+					glm::vec<3, double> temp = Nodes[i]->Position;
+					Nodes[i]->Position += (Nodes[i]->Position - Nodes[i]->OldPosition) + Nodes[i]->Acceleration * dt * dt;
+					Nodes[i]->OldPosition = temp;
+				}
+			}
+			// clear the force
+			for (int i = 0; i < Nodes.size(); i++)
+			{
+				Nodes[i]->Force = glm::vec<3, double>(0, 0, 0);
+			}
+		}
+	}
+
+	/** for implicit integration **/
+	const double CG_TOLERANCE = 1.0e-3; // relative residual of the conjugate gradient solve
+	std::vector<glm::ivec4> SpringBlocks; // blocks (i, i), (j, j), (i, j), (j, i) of every spring
+	std::vector<glm::vec<3, GLdouble>> SystemRhs, DeltaVelocity;
+	/** end of for implicit integration **/
+
+	// Backward Euler (Baraff & Witkin 1998): solve
+	// (M - dt * df/dv - dt^2 * df/dx) dv = dt * (f + dt * df/dx * v)
+	// once per frame, pinned nodes keep dv = 0.
+	void integrateImplicit(GLdouble dt)
+	{
+		int n = (int)Nodes.size();
+		{
+			TRACE_SCOPE("assemble system");
+			SystemRhs.assign(n, glm::vec<3, GLdouble>(0.0));
+			// the last dv is the initial guess of the solve, only reset when the cloth is rebuilt
+			if (DeltaVelocity.size() != n) DeltaVelocity.assign(n, glm::vec<3, GLdouble>(0.0));
+			SystemMatrix.setZero();
+
+			// forces: external ones are already in Node::Force
+			for (int i = 0; i < n; i++)
+			{
+				if (Nodes[i]->InvMass == 0.0) continue;
+				Nodes[i]->addForce(Material.Gravity * 1.0 / Nodes[i]->InvMass);
+			}
+			for (int i = 0; i < Springs.size(); i++)
+				Springs[i]->applyInternalForce(dt);
+			for (int i = 0; i < n; i++)
+			{
+				GLdouble mass = Nodes[i]->InvMass == 0.0 ? 1.0 : 1.0 / Nodes[i]->InvMass;
+				SystemMatrix.Blocks[SystemMatrix.Diagonal[i]] = glm::dmat3(mass);
+				if (Nodes[i]->InvMass != 0.0) SystemRhs[i] = dt * Nodes[i]->Force;
+			}
+
+			// spring derivatives
+			glm::dmat3 dfdx, dfdv;
+			for (int s = 0; s < Springs.size(); s++)
+			{
+				Node* n1 = Springs[s]->Node1;
+				Node* n2 = Springs[s]->Node2;
+				Springs[s]->computeJacobian(dfdx, dfdv);
+				glm::dmat3 block = dt * dfdv + dt * dt * dfdx;
+				glm::vec<3, GLdouble> stiffnessTerm = dt * dt * (dfdx * (n2->Velocity - n1->Velocity));
+				bool free1 = n1->InvMass != 0.0, free2 = n2->InvMass != 0.0;
+				glm::ivec4 blocks = SpringBlocks[s];
+				if (free1) { SystemMatrix.Blocks[blocks.x] += block; SystemRhs[n1->Index] += stiffnessTerm; }
+				if (free2) { SystemMatrix.Blocks[blocks.y] += block; SystemRhs[n2->Index] -= stiffnessTerm; }
+				if (free1 && free2)
+				{
+					SystemMatrix.Blocks[blocks.z] -= block;
+					SystemMatrix.Blocks[blocks.w] -= block;
+				}
+			}
+		}
+
+		TRACE_SCOPE("conjugate gradient");
+		Stats.Iterations = SolvePCG(SystemMatrix, SystemRhs, DeltaVelocity, Iteration, CG_TOLERANCE, Stats.RmsResidual);
+		Stats.TotalIterations += Stats.Iterations;
+		Stats.MaxResidual = Stats.RmsResidual;
+
+		for (int i = 0; i < n; i++)
+		{
+			Nodes[i]->Force = glm::vec<3, double>(0, 0, 0);
+			if (Nodes[i]->InvMass == 0.0) continue;
+			Nodes[i]->Velocity += DeltaVelocity[i];
+			Nodes[i]->OldPosition = Nodes[i]->Position;
+			Nodes[i]->Position += Nodes[i]->Velocity * dt;
+		}
+	}
+
+	/** for node based solvers (Projective_Dynamics, Vertex_Block_Descent and the JACOBI sweep) **/
+	const GLdouble MAX_STIFFNESS = 1.0e5; // stiffness of zero compliance constraints, which neither method can make rigid
+	std::vector<GLdouble> ConstraintWeight; // w_c = 1 / compliance of every constraint
+	std::vector<int> IncidenceStart, IncidenceConstraint; // constraints of every node, Node1 stored as c + 1, Node2 as -(c + 1)
+	std::vector<glm::vec<3, GLdouble>> Inertia; // y = x + dt * v + dt^2 * a
+	/** end of for node based solvers **/
+
+	/** for projective dynamics **/
+	GLdouble FactoredTimeStep = 0.0; // dt SystemFactor was built for, 0 if it is not factored
+	std::vector<glm::vec<3, GLdouble>> Projection; // p_c, the projected Node1 - Node2 of every constraint
+	std::vector<glm::vec<3, GLdouble>> SystemSolution; // x of the global step
+	std::vector<GLdouble> ProjectionResidual; // relative violation of every constraint before its projection
+	/** end of for projective dynamics **/
+
+	// Projective Dynamics (Bouaziz et al. 2014): every constraint c adds the energy w_c / 2 * |x1 - x2 - p_c|^2
+	// where p_c is the closest edge vector of rest length. The local step projects all constraints in parallel,
+	// the global step solves (M / dt^2 + sum w_c A_c^T A_c) x = M / dt^2 * y + sum w_c A_c^T p_c, whose matrix
+	// never changes, so it is factored once and every global step is a back-substitution.
+	void integrateProjective(GLdouble dt)
+	{
+		int n = (int)Nodes.size();
+		if (FactoredTimeStep != dt) factorProjective(dt);
+		SystemSolution.resize(n);
+		Projection.resize(Constraints.size());
+		ProjectionResidual.resize(Constraints.size());
+		predictInertia(dt);
+
+		for (int iter = 0; iter < Iteration; iter++)
+		{
+			TRACE_SCOPE("local and global step");
+			// local step
+			threadPool.ParallelFor(0, (int)Constraints.size(), [&](int c)
+			{
+				glm::vec<3, GLdouble> edge = Nodes[Constraints[c].GetNode1()]->Position - Nodes[Constraints[c].GetNode2()]->Position;
+				GLdouble length = glm::length(edge), restLength = Constraints[c].GetRestLength();
+				Projection[c] = length > 0.0 ? edge * (restLength / length) : edge;
+				ProjectionResidual[c] = std::abs(length - restLength) / restLength;
+			});
+			// global step, the right hand side is gathered per node so the sum has a fixed order
+			threadPool.ParallelFor(0, n, [&](int i)
+			{
+				Node* node = Nodes[i];
+				if (node->InvMass == 0.0) { SystemSolution[i] = node->Position; return; }
+				glm::vec<3, GLdouble> rhs = Inertia[i] / (node->InvMass * dt * dt);
+				for (int k = IncidenceStart[i]; k < IncidenceStart[i + 1]; k++)
+				{
+					int c = std::abs(IncidenceConstraint[k]) - 1;
+					bool first = IncidenceConstraint[k] > 0;
+					Node* other = Nodes[first ? Constraints[c].GetNode2() : Constraints[c].GetNode1()];
+					rhs += ConstraintWeight[c] * (first ? Projection[c] : -Projection[c]);
+					if (other->InvMass == 0.0) rhs += ConstraintWeight[c] * other->Position; // pinned, moved to the right hand side
+				}
+				SystemSolution[i] = rhs;
+			});
+			SystemFactor.Solve(SystemSolution);
+			for (int i = 0; i < n; i++)
+				if (Nodes[i]->InvMass != 0.0) Nodes[i]->Position = SystemSolution[i];
+
+			GLdouble maxResidual = 0.0, squareResidual = 0.0;
+			for (GLdouble r : ProjectionResidual) { maxResidual = std::max(maxResidual, r); squareResidual += r * r; }
+			Stats.Iterations++;
+			Stats.TotalIterations++;
+			Stats.MaxResidual = maxResidual;
+			Stats.RmsResidual = ProjectionResidual.empty() ? 0.0 : std::sqrt(squareResidual / ProjectionResidual.size());
+			if (Method.TrackConvergence) Stats.ResidualHistory.push_back(Stats.RmsResidual);
+		}
+
+		updateVelocityFromPosition(dt);
+	}
+
+	// The matrix structure follows the constraints
+	void initProjective()
+	{
+		std::vector<std::pair<int, int>> couplings;
+		for (int c = 0; c < Constraints.size(); c++)
+			couplings.push_back(std::make_pair(Constraints[c].GetNode1(), Constraints[c].GetNode2()));
+		SystemFactor.Build((int)Nodes.size(), couplings);
+		FactoredTimeStep = 0.0;
+	}
+
+	// Assemble and factor the global matrix, pinned nodes get an identity row and no couplings
+	void factorProjective(GLdouble dt)
+	{
+		int n = (int)Nodes.size();
+		std::fill(SystemFactor.Values.begin(), SystemFactor.Values.end(), 0.0);
+		for (int i = 0; i < n; i++)
+			SystemFactor.add(i, i, Nodes[i]->InvMass == 0.0 ? 1.0 : 1.0 / (Nodes[i]->InvMass * dt * dt));
+		for (int c = 0; c < Constraints.size(); c++)
+		{
+			Node* n1 = Nodes[Constraints[c].GetNode1()];
+			Node* n2 = Nodes[Constraints[c].GetNode2()];
+			GLdouble w = ConstraintWeight[c];
+			bool free1 = n1->InvMass != 0.0, free2 = n2->InvMass != 0.0;
+			if (free1) SystemFactor.add(n1->Index, n1->Index, w);
+			if (free2) SystemFactor.add(n2->Index, n2->Index, w);
+			if (free1 && free2) SystemFactor.add(n1->Index, n2->Index, -w);
+		}
+		if (!SystemFactor.Factor()) printf("Projective Dynamics system matrix is not positive definite.\n");
+		FactoredTimeStep = dt;
+	}
+
+	/** for vertex block descent **/
+	std::vector<std::vector<int>> ColorNodes; // nodes of every color, no constraint connects two nodes of one color
+	/** end of for vertex block descent **/
+
+	// Vertex Block Descent (Chen et al. 2024): minimize the incremental potential
+	// m / (2 dt^2) |x - y|^2 + sum w_c / 2 (|x1 - x2| - L_c)^2 one node at a time with a 3x3 Newton step.
+	// One pass over all colors is a sweep of solveConstraints, so SOR, Chebyshev and the tolerance apply too.
+	void integrateVertexBlockDescent(GLdouble dt)
+	{
+		predictInertia(dt);
+		solveConstraints<Vertex_Block_Descent>(dt, Iteration);
+		if (!measureEverySweep()) measureResidual();
+		updateVelocityFromPosition(dt);
+	}
+
+	// Nodes of one color don't share a constraint, so they are updated in parallel
+	void sweepNodes(GLdouble dt, GLdouble omega)
+	{
+		TRACE_SCOPE("sweep nodes");
+		for (std::vector<int>& color : ColorNodes)
+			threadPool.ParallelFor(0, (int)color.size(), [&](int k) { solveNodeBlock(Nodes[color[k]], dt, omega); });
+		Stats.Iterations++;
+		Stats.TotalIterations++;
+		if (measureEverySweep()) measureResidual();
+	}
+
+	void solveNodeBlock(Node* node, GLdouble dt, GLdouble omega)
+	{
+		if (node->InvMass == 0.0) return;
+		int i = node->Index;
+		GLdouble inertia = 1.0 / (node->InvMass * dt * dt);
+		glm::vec<3, GLdouble> force = -inertia * (node->Position - Inertia[i]);
+		// hessian = diagonal * I + sum of outer products, kept as its 6 distinct entries
+		GLdouble diagonal = inertia, xx = 0.0, yy = 0.0, zz = 0.0, xy = 0.0, xz = 0.0, yz = 0.0;
+		for (int k = IncidenceStart[i]; k < IncidenceStart[i + 1]; k++)
+		{
+			int c = std::abs(IncidenceConstraint[k]) - 1;
+			Node* other = Nodes[IncidenceConstraint[k] > 0 ? Constraints[c].GetNode2() : Constraints[c].GetNode1()];
+			glm::vec<3, GLdouble> edge = node->Position - other->Position;
+			GLdouble length = glm::length(edge), restLength = Constraints[c].GetRestLength(), w = ConstraintWeight[c];
+			if (length == 0.0) continue;
+			glm::vec<3, GLdouble> direction = edge / length;
+			force -= w * (length - restLength) * direction;
+			// w * (n n^T + s * (I - n n^T)), the transverse part s is negative for a compressed
+			// constraint and clamped to keep the hessian definite
+			GLdouble transverse = std::max(0.0, 1.0 - restLength / length), axial = w * (1.0 - transverse);
+			diagonal += w * transverse;
+			xx += axial * direction.x * direction.x;
+			yy += axial * direction.y * direction.y;
+			zz += axial * direction.z * direction.z;
+			xy += axial * direction.x * direction.y;
+			xz += axial * direction.x * direction.z;
+			yz += axial * direction.y * direction.z;
+		}
+		glm::dmat3 hessian(diagonal + xx, xy, xz, xy, diagonal + yy, yz, xz, yz, diagonal + zz);
+		node->Position += omega * (glm::inverse(hessian) * force);
+	}
+
+	// Grid coloring: constraints reach at most 2 nodes away with bending, 1 without,
+	// so coloring by (w mod stride, h mod stride) with stride one more than that separates every pair.
+	void initVertexBlockDescent()
+	{
+		int stride = ConstraintLevel > 0 ? 3 : 2;
+		ColorNodes.assign(stride * stride, std::vector<int>());
+		for (int h = 0; h < NodesInHeight; h++)
+			for (int w = 0; w < NodesInWidth; w++)
+				ColorNodes[(h % stride) * stride + w % stride].push_back(NodeSlot[h * NodesInWidth + w]);
+		// visit every color in storage order, so consecutive nodes of a color are close in memory
+		for (std::vector<int>& color : ColorNodes) std::sort(color.begin(), color.end());
+	}
+
+	// Constraint weights and per node incidence, shared by the node based solvers
+	void initIncidence()
+	{
+		int n = (int)Nodes.size();
+		ConstraintWeight.resize(Constraints.size());
+		std::vector<int> count(n, 0);
+		for (int c = 0; c < Constraints.size(); c++)
+		{
+			GLdouble compliance = Constraints[c].GetCompliance();
+			ConstraintWeight[c] = compliance > 1.0 / MAX_STIFFNESS ? 1.0 / compliance : MAX_STIFFNESS;
+			count[Constraints[c].GetNode1()]++;
+			count[Constraints[c].GetNode2()]++;
+		}
+		IncidenceStart.assign(n + 1, 0);
+		for (int i = 0; i < n; i++) IncidenceStart[i + 1] = IncidenceStart[i] + count[i];
+		IncidenceConstraint.resize(IncidenceStart[n]);
+		std::vector<int> next(IncidenceStart.begin(), IncidenceStart.end() - 1);
+		for (int c = 0; c < Constraints.size(); c++)
+		{
+			IncidenceConstraint[next[Constraints[c].GetNode1()]++] = c + 1;
+			IncidenceConstraint[next[Constraints[c].GetNode2()]++] = -(c + 1);
+		}
+	}
+
+	// Start every free node at its inertial position y = x + dt * v + dt^2 * a
+	void predictInertia(GLdouble dt)
+	{
+		TRACE_SCOPE("predict");
+		Inertia.resize(Nodes.size());
+		for (int i = 0; i < Nodes.size(); i++)
+		{
+			Nodes[i]->OldPosition = Nodes[i]->Position;
+			if (Nodes[i]->InvMass == 0.0) Inertia[i] = Nodes[i]->Position;
+			else Inertia[i] = Nodes[i]->Position + Nodes[i]->Velocity * dt + Nodes[i]->Acceleration * dt * dt;
+			Nodes[i]->Position = Inertia[i];
+		}
+	}
+
+	void updateVelocityFromPosition(GLdouble dt)
+	{
+		TRACE_SCOPE("update velocity");
+		for (int i = 0; i < Nodes.size(); i++)
+		{
+			if (Nodes[i]->InvMass == 0.0) continue;
+			Nodes[i]->Velocity = (Nodes[i]->Position - Nodes[i]->OldPosition) / dt;
+		}
+	}
+
+	// the residual costs as much as a sweep, node based solvers only measure it every sweep if it is used
+	bool measureEverySweep() { return Method.Tolerance > 0.0 || Method.TrackConvergence; }
+
+	// Residual of the current positions for Stats
+	void measureResidual()
+	{
+		TRACE_SCOPE("measure residual");
+		GLdouble maxResidual = 0.0, squareResidual = 0.0;
+		for (int i = 0; i < Constraints.size(); i++)
+		{
+			GLdouble constraint = std::abs(Constraints[i].GetCurrentLength(NodeStorage.data()) - Constraints[i].GetRestLength()) / Constraints[i].GetRestLength();
+			maxResidual = std::max(maxResidual, constraint);
+			squareResidual += constraint * constraint;
+		}
+		Stats.MaxResidual = maxResidual;
+		Stats.RmsResidual = Constraints.empty() ? 0.0 : std::sqrt(squareResidual / Constraints.size());
+		if (Method.TrackConvergence) Stats.ResidualHistory.push_back(Stats.RmsResidual);
+	}
+
+	/** for constraint solving **/
+	const int CHEBYSHEV_DELAY = 2; // plain iterations before Chebyshev acceleration starts
+	std::vector<glm::vec<3, GLdouble>> JacobiCorrection; // deltaPosition of every constraint in a Jacobi sweep
+	std::vector<GLdouble> JacobiResidual;
+	std::vector<glm::vec<3, GLdouble>> IterationPrevious, IterationCurrent; // x^(k-1) and x^k for Chebyshev
+	/** end of for constraint solving **/
+
+	template<MethodEnum M>
+	void solveConstraints(GLdouble dt, int iterations)
+	{
+		bool chebyshev = Method.Acceleration == ACCEL_CHEBYSHEV;
+		GLdouble inverseDtSquare = 1.0 / (dt * dt); // once per (sub)step, every constraint scales its compliance by it
+		GLdouble omega = Method.Acceleration == ACCEL_SOR ? Method.Omega : 1.0;
+		GLdouble rho2 = Method.SpectralRadius * Method.SpectralRadius, chebyshevOmega = 1.0;
+		if (chebyshev)
+		{
+			IterationPrevious.resize(Nodes.size());
+			IterationCurrent.resize(Nodes.size());
+			for (int i = 0; i < Nodes.size(); i++) IterationPrevious[i] = Nodes[i]->Position;
+		}
+		for (int n = 0; n < iterations; n++)
+		{
+			if (chebyshev)
+				for (int i = 0; i < Nodes.size(); i++) IterationCurrent[i] = Nodes[i]->Position;
+
+			if constexpr (M == Vertex_Block_Descent) sweepNodes(dt, omega);
+			else sweepConstraints<M>(dt, inverseDtSquare, omega);
+
+			if (chebyshev)
+			{
+				// x^(k+1) = omega_(k+1) * (x_hat^(k+1) - x^(k-1)) + x^(k-1)
+				if (n < CHEBYSHEV_DELAY) chebyshevOmega = 1.0;
+				else if (n == CHEBYSHEV_DELAY) chebyshevOmega = 2.0 / (2.0 - rho2);
+				else chebyshevOmega = 4.0 / (4.0 - rho2 * chebyshevOmega);
+				for (int i = 0; i < Nodes.size(); i++)
+				{
+					if (Nodes[i]->InvMass != 0.0)
+						Nodes[i]->Position = chebyshevOmega * (Nodes[i]->Position - IterationPrevious[i]) + IterationPrevious[i];
+					IterationPrevious[i] = IterationCurrent[i];
+				}
+			}
+			// after the extrapolation, so the stretch bound holds for every iterate
+			if (!Tethers.empty())
+				threadPool.ParallelFor(0, (int)Tethers.size(), [&](int i) { Tethers[i].Solve(); });
+
+			// adaptive iteration: a converged cloth needs no more sweeps
+			if (Method.Tolerance > 0.0 && n + 1 >= Method.MinIteration
+				&& (Method.ToleranceOnMax ? Stats.MaxResidual : Stats.RmsResidual) < Method.Tolerance)
+				break;
+		}
+	}
+
+	// One sweep over all constraints (PBD, XPBD and XPBD_SS), also measures the residual (relative violation |C| / RestLength) for Stats
+	template<MethodEnum M>
+	void sweepConstraints(GLdouble dt, GLdouble inverseDtSquare, GLdouble omega)
+	{
+		TRACE_SCOPE("sweep constraints");
+		Node* nodes = NodeStorage.data();
+		GLdouble maxResidual = 0.0, squareResidual = 0.0, constraint;
+		if (Method.Solver == JACOBI)
+		{
+			// Every constraint writes only its own slots and every node sums its incident constraints in
+			// the fixed incidence order, so the result is bit identical for any number of threads.
+			JacobiCorrection.resize(Constraints.size());
+			JacobiResidual.resize(Constraints.size());
+			threadPool.ParallelFor(0, (int)Constraints.size(), [&](int c)
+			{
+				JacobiResidual[c] = std::abs(Constraints[c].SolveJacobi<M>(nodes, inverseDtSquare, JacobiCorrection[c])) / Constraints[c].GetRestLength();
+			});
+			// average the corrections of every node, omega < 1 under-relaxes
+			threadPool.ParallelFor(0, (int)Nodes.size(), [&](int i)
+			{
+				Node* node = Nodes[i];
+				int count = IncidenceStart[i + 1] - IncidenceStart[i];
+				if (node->InvMass == 0.0 || count == 0) return;
+				glm::vec<3, GLdouble> correction(0.0, 0.0, 0.0);
+				for (int k = IncidenceStart[i]; k < IncidenceStart[i + 1]; k++)
+				{
+					int c = std::abs(IncidenceConstraint[k]) - 1;
+					correction += IncidenceConstraint[k] > 0 ? JacobiCorrection[c] : -JacobiCorrection[c];
+				}
+				node->Position += omega * node->InvMass * correction / (GLdouble)count;
+			});
+			for (int c = 0; c < Constraints.size(); c++)
+			{
+				maxResidual = std::max(maxResidual, JacobiResidual[c]);
+				squareResidual += JacobiResidual[c] * JacobiResidual[c];
+			}
+		}
+		else
+		{
+			for (int i = 0; i < Constraints.size(); i++)
+			{
+				constraint = std::abs(Constraints[i].Solve<M>(nodes, inverseDtSquare, omega)) / Constraints[i].GetRestLength();
+				maxResidual = std::max(maxResidual, constraint);
+				squareResidual += constraint * constraint;
+			}
+		}
+		// membrane and bending are solved after the distance constraints in both solvers, serially so they stay deterministic
+		Membrane.Solve<M>(dt, omega, maxResidual, squareResidual);
+		// isometric bending stays out of the residual: |C| is the curvature, which a soft bending element keeps
+		// (RMS near 0.5 on the hanging cloth), so it would hold every Tolerance above its stop
+		for (int i = 0; i < Bendings.size(); i++)
+			Bendings[i].Solve<M>(dt, omega);
+		int residualCount = (int)Constraints.size() + 2 * Membrane.size();
+		Stats.Iterations++;
+		Stats.TotalIterations++;
+		Stats.MaxResidual = maxResidual;
+		Stats.RmsResidual = residualCount == 0 ? 0.0 : std::sqrt(squareResidual / residualCount);
+		if (Method.TrackConvergence) Stats.ResidualHistory.push_back(Stats.RmsResidual);
+	}
+
+	// Constraints followed by the constraints of every hierarchy level
+	std::vector<Constraint*> getAllConstraints()
+	{
+		std::vector<Constraint*> constraints;
+		for (int i = 0; i < Constraints.size(); i++) constraints.push_back(&Constraints[i]);
+		for (ConstraintHierarchy::Level& level : Hierarchy.Levels)
+			for (int i = 0; i < level.Constraints.size(); i++) constraints.push_back(&level.Constraints[i]);
+		return constraints;
+	}
+
+	// constraints between two pinned nodes are dropped, they would only cost time in every sweep
+	void MakeConstraint(Node* n1, Node* n2, GLdouble compliance = 0.0f)
+	{
+		if (Constraint::IsNeeded(n1, n2)) Constraints.push_back(Constraint(n1, n2, compliance));
+	}
 
 	void init()
 	{
 		initNodes();
 		initFaces();
 		initConstraints();
+		NormalsDirty = true;
 	}
 
 	void initNodes()
 	{
 		Nodes.resize(NodesInWidth * NodesInHeight);
+		NodeStorage.resize(NodesInWidth * NodesInHeight); // never resized again, Nodes points into it
+		initNodeOrder();
 		printf("Init cloth with %d nodes, %d in width and %d in height.\n", NodesInWidth * NodesInHeight, NodesInWidth, NodesInHeight);
 		for (int w = 0; w < NodesInWidth; w++) {
 			for (int h = 0; h < NodesInHeight; h++) {
 				/** Create node by position **/
 				glm::vec3 position = glm::vec3(Width * (GLdouble)w / (GLdouble)NodesInWidth, -(Height * (GLdouble)h / (GLdouble)NodesInHeight), 0.0f);
-				GLdouble invMass = DEFAULT_INVMASS;
-				if ((h == 0) && (w == 0) || (h == 0) && (w == NodesInWidth - 1)) { invMass = 0.0f; }
-				Node* node = new Node(invMass, position, gravity);
+				GLdouble invMass = Material.InvMass;
+				if (Material.isPinned(w, h, NodesInWidth, NodesInHeight, glm::ivec2(Method.MethodClothNodesNumber))) { invMass = 0.0f; }
+				int slot = NodeSlot[h * NodesInWidth + w];
+				Node* node = &NodeStorage[slot];
+				*node = Node(invMass, position, Material.Gravity);
 				/** Set texture coordinates **/
 				node->TextureCoord.y = (double)h / (NodesInHeight - 1);
 				node->TextureCoord.x = (double)w / (1 - NodesInWidth);
 				/** Add node to cloth **/
-				Nodes[h * NodesInWidth + w] = node;
+				node->Index = slot;
+				Nodes[slot] = node;
 				// std::cout << node << std::endl;
 				// printf("\t%d: [%d, %d] (%f, %f, %f) - (%f, %f)\n", h * NodesInWidth + w, w, h, node->Position.x, node->Position.y, node->Position.z, node->TextureCoord.x, node->TextureCoord.y);
 			}
@@ -322,41 +1008,55 @@ private:
 		}
 		// printf("Actual cloth has %i nodes.\n", Nodes.size());
 
-		if (Method.getId() > 3) // mass-spring system
+		if (Method.isMassSpring())
 		{
 			for (int i = 0; i < NodesInHeight; i++) {
 				for (int j = 0; j < NodesInWidth; j++) {
 					// Structural
-					if (i < NodesInHeight - 1) Springs.push_back(new Spring(getNode(i, j), getNode(i + 1, j), STRUCTURE_COEF));
-					if (j < NodesInWidth - 1) Springs.push_back(new Spring(getNode(i, j), getNode(i, j + 1), STRUCTURE_COEF));
+					if (i < NodesInHeight - 1) Springs.push_back(new Spring(getNode(i, j), getNode(i + 1, j), Material.StructureCoef));
+					if (j < NodesInWidth - 1) Springs.push_back(new Spring(getNode(i, j), getNode(i, j + 1), Material.StructureCoef));
 					// Shear 
 					if (i < NodesInHeight - 1 && j < NodesInWidth - 1)
 					{
-						Springs.push_back(new Spring(getNode(i, j), getNode(i + 1, j + 1), SHEAR_COEF));
-						Springs.push_back(new Spring(getNode(i + 1, j), getNode(i, j + 1), SHEAR_COEF));
+						Springs.push_back(new Spring(getNode(i, j), getNode(i + 1, j + 1), Material.ShearCoef));
+						Springs.push_back(new Spring(getNode(i + 1, j), getNode(i, j + 1), Material.ShearCoef));
 					}
 					// Bending
-					if (i < NodesInHeight - 2) Springs.push_back(new Spring(getNode(i, j), getNode(i + 2, j), BENDING_COEF));
-					if (j < NodesInWidth - 2) Springs.push_back(new Spring(getNode(i, j), getNode(i, j + 2), BENDING_COEF));
+					if (i < NodesInHeight - 2) Springs.push_back(new Spring(getNode(i, j), getNode(i + 2, j), Material.BendingCoef));
+					if (j < NodesInWidth - 2) Springs.push_back(new Spring(getNode(i, j), getNode(i, j + 2), Material.BendingCoef));
 				}
 			}
 			//for (int i = 0; i < NodesInWidth; i++) {
 			//	for (int j = 0; j < NodesInHeight; j++) {
 			//		// Structural
-			//		if (i < NodesInWidth - 1) Springs.push_back(new Spring(getNode(i, j), getNode(i + 1, j), STRUCTURE_COEF));
-			//		if (j < NodesInHeight - 1) Springs.push_back(new Spring(getNode(i, j), getNode(i, j + 1), STRUCTURE_COEF));
+			//		if (i < NodesInWidth - 1) Springs.push_back(new Spring(getNode(i, j), getNode(i + 1, j), Material.StructureCoef));
+			//		if (j < NodesInHeight - 1) Springs.push_back(new Spring(getNode(i, j), getNode(i, j + 1), Material.StructureCoef));
 			//		// Shear 
 			//		if (i < NodesInWidth - 1 && j < NodesInHeight - 1)
 			//		{
-			//			Springs.push_back(new Spring(getNode(i, j), getNode(i + 1, j + 1), SHEAR_COEF));
-			//			Springs.push_back(new Spring(getNode(i + 1, j), getNode(i, j + 1), SHEAR_COEF));
+			//			Springs.push_back(new Spring(getNode(i, j), getNode(i + 1, j + 1), Material.ShearCoef));
+			//			Springs.push_back(new Spring(getNode(i + 1, j), getNode(i, j + 1), Material.ShearCoef));
 			//		}
 			//		// Bending
-			//		if (i < NodesInWidth - 2) Springs.push_back(new Spring(getNode(i, j), getNode(i + 2, j), BENDING_COEF));
-			//		if (j < NodesInHeight - 2) Springs.push_back(new Spring(getNode(i, j), getNode(i, j + 2), BENDING_COEF));
+			//		if (i < NodesInWidth - 2) Springs.push_back(new Spring(getNode(i, j), getNode(i + 2, j), Material.BendingCoef));
+			//		if (j < NodesInHeight - 2) Springs.push_back(new Spring(getNode(i, j), getNode(i, j + 2), Material.BendingCoef));
 			//	}
 			//}
 			printf("Cloth has %i springs.\n", Springs.size());
+
+			if (Method.getId() == Implicit_Euler)
+			{
+				for (Spring* spring : Springs) spring->HookPara *= IMPLICIT_STIFFNESS_SCALE;
+				std::vector<std::pair<int, int>> couplings;
+				for (Spring* spring : Springs) couplings.push_back(std::make_pair(spring->Node1->Index, spring->Node2->Index));
+				SystemMatrix.Build((int)Nodes.size(), couplings);
+				SpringBlocks.clear();
+				for (Spring* spring : Springs)
+				{
+					int i = spring->Node1->Index, j = spring->Node2->Index;
+					SpringBlocks.push_back(glm::ivec4(SystemMatrix.Diagonal[i], SystemMatrix.Diagonal[j], SystemMatrix.find(i, j), SystemMatrix.find(j, i)));
+				}
+			}
 		}
 	}
 
@@ -378,29 +1078,45 @@ private:
 				Faces.push_back(node2);
 				Faces.push_back(node1);
 				Faces.push_back(node3);
+				GLuint index0 = h * NodesInWidth + w, index1 = index0 + 1, index2 = index0 + NodesInWidth, index3 = index2 + 1;
+				FaceIndices.insert(FaceIndices.end(), { index0, index1, index2, index2, index1, index3 });
 			}
 		}
 	}
 
 	void initConstraints()
 	{
-		// Distance constraints
-		for (int w = 0; w < NodesInWidth; w++)
+		// isometric bending is only solved by the constraint sweeps, the other methods get the distance bending it stands for
+		if (Method.Bending == BENDING_ISOMETRIC && !Method.isPositionBased())
+		{
+			printf("%s doesn't solve isometric bending, using distance bending constraints instead.\n", Method.getName().c_str());
+			Method.Bending = BENDING_DISTANCE;
+			if (ConstraintLevel == 0) ConstraintLevel = 3;
+		}
+		// Distance constraints, or the strain membrane replacing them
+		bool strainMembrane = Method.Membrane == MEMBRANE_STRAIN && Method.isPositionBased();
+		if (strainMembrane)
+		{
+			Membrane.Build(Faces, Material.WarpCompliance, Material.WeftCompliance, Material.ShearCompliance, Method.StrainLimit);
+			printf("Total membrane triangles number: %d\n", Membrane.size());
+		}
+		for (int w = 0; w < NodesInWidth && !strainMembrane; w++)
 		{
 			for (int h = 0; h < NodesInHeight; h++)
 			{
 				// Each edges have a distance constraint
-				if (w < NodesInWidth - 1) { MakeConstraint(getNode(w, h), getNode(w + 1, h), DISTANCE_COMPLIANCE); }
-				if (h < NodesInHeight - 1) { MakeConstraint(getNode(w, h), getNode(w, h + 1), DISTANCE_COMPLIANCE); }
+				if (w < NodesInWidth - 1) { MakeConstraint(getNode(w, h), getNode(w + 1, h), Material.DistanceCompliance); }
+				if (h < NodesInHeight - 1) { MakeConstraint(getNode(w, h), getNode(w, h + 1), Material.DistanceCompliance); }
 				if (w + 1 < NodesInWidth && h + 1 < NodesInHeight)
 				{
-					MakeConstraint(getNode(w + 1, h), getNode(w, h + 1), DISTANCE_COMPLIANCE);
-					MakeConstraint(getNode(w, h), getNode(w + 1, h + 1), DISTANCE_COMPLIANCE);
+					MakeConstraint(getNode(w + 1, h), getNode(w, h + 1), Material.DistanceCompliance);
+					MakeConstraint(getNode(w, h), getNode(w + 1, h + 1), Material.DistanceCompliance);
 				}
 			}
 		}
 		// Bending constraints
-		if (ConstraintLevel > 0)
+		if (Method.Bending == BENDING_ISOMETRIC) initBending();
+		else if (ConstraintLevel > 0)
 		{
 			for (int w = 0; w < NodesInWidth; w++)
 			{
@@ -408,16 +1124,16 @@ private:
 				{
 					if (ConstraintLevel != 2)
 					{
-						if (w < NodesInWidth - 2) { MakeConstraint(getNode(w, h), getNode(w + 2, h), BENDING_COMPLIANCE); }
-						if (h < NodesInHeight - 2) { MakeConstraint(getNode(w, h), getNode(w, h + 2), BENDING_COMPLIANCE); }
+						if (w < NodesInWidth - 2) { MakeConstraint(getNode(w, h), getNode(w + 2, h), Material.BendingCompliance); }
+						if (h < NodesInHeight - 2) { MakeConstraint(getNode(w, h), getNode(w, h + 2), Material.BendingCompliance); }
 					}
 
 					if (ConstraintLevel != 1)
 					{
 						if (w < NodesInWidth - 2 && h < NodesInHeight - 2)
 						{
-							MakeConstraint(getNode(w, h), getNode(w + 2, h + 2), BENDING_COMPLIANCE);
-							MakeConstraint(getNode(w + 2, h), getNode(w, h + 2), BENDING_COMPLIANCE);
+							MakeConstraint(getNode(w, h), getNode(w + 2, h + 2), Material.BendingCompliance);
+							MakeConstraint(getNode(w + 2, h), getNode(w, h + 2), Material.BendingCompliance);
 						}
 					}
 				}
@@ -427,16 +1143,142 @@ private:
 		// so use shuffle with determined seed to avoid this situation.
 		auto rng = std::default_random_engine{ 15162428 };
 		std::shuffle(std::begin(Constraints), std::end(Constraints), rng);
+		if (useLocalityOrder()) orderConstraints(rng);
 		printf("Total constraints number: %d\n", Constraints.size());
+		findStretchConstraints();
+
+		if (Method.HierarchyLevels > 0 && !Method.usesHierarchy())
+			printf("%s doesn't solve a constraint hierarchy, HierarchyLevels is ignored.\n", Method.getName().c_str());
+		else if (Method.HierarchyLevels > 0)
+		{
+			Hierarchy.Build(NodeStorage.data(), NodeSlot, NodesInWidth, NodesInHeight, Method.HierarchyLevels, Material.DistanceCompliance);
+			printf("Constraint hierarchy built with %zu coarse levels.\n", Hierarchy.Levels.size());
+		}
+		if (Method.UseTethers) initTethers();
+		if (Method.getId() == Projective_Dynamics || Method.getId() == Vertex_Block_Descent || Method.Solver == JACOBI) initIncidence();
+		if (Method.getId() == Projective_Dynamics) initProjective();
+		if (Method.getId() == Vertex_Block_Descent) initVertexBlockDescent();
+	}
+
+	// After the shuffle the kind of a constraint is told by its nodes: stretch constraints join grid neighbours,
+	// bending ones reach 2 nodes far
+	void findStretchConstraints()
+	{
+		std::vector<int> gridIndex(NodeSlot.size());
+		for (int g = 0; g < NodeSlot.size(); g++) gridIndex[NodeSlot[g]] = g;
+		StretchConstraints.clear();
+		for (int i = 0; i < Constraints.size(); i++)
+		{
+			int g1 = gridIndex[Constraints[i].GetNode1()], g2 = gridIndex[Constraints[i].GetNode2()];
+			if (std::abs(g1 % NodesInWidth - g2 % NodesInWidth) <= 1 && std::abs(g1 / NodesInWidth - g2 / NodesInWidth) <= 1)
+				StretchConstraints.push_back(i);
+		}
+	}
+
+	// Projective_Dynamics factors its matrix in skyline storage, whose envelope is only narrow for the row order
+	bool useLocalityOrder() { return Method.LocalityOrder && Method.getId() != Projective_Dynamics; }
+
+	// Store the nodes along a Morton (Z-order) curve of the grid: the nodes of every 2^k x 2^k square are
+	// contiguous, so the few neighbours a constraint or a node block reaches share cache lines, while the
+	// row order puts the node below 1 row of nodes further away. Otherwise slot = grid index.
+	void initNodeOrder()
+	{
+		int n = NodesInWidth * NodesInHeight;
+		NodeSlot.resize(n);
+		std::vector<int> order(n);
+		for (int i = 0; i < n; i++) order[i] = i;
+		if (useLocalityOrder())
+		{
+			std::vector<unsigned long long> key(n);
+			for (int i = 0; i < n; i++) key[i] = mortonKey(i % NodesInWidth, i / NodesInWidth);
+			std::sort(order.begin(), order.end(), [&](int a, int b) { return key[a] < key[b]; });
+		}
+		for (int slot = 0; slot < n; slot++) NodeSlot[order[slot]] = slot;
+	}
+
+	// interleave the bits of w and h
+	static unsigned long long mortonKey(unsigned int w, unsigned int h)
+	{
+		unsigned long long key = 0;
+		for (int bit = 0; bit < 32; bit++)
+			key |= ((unsigned long long)((w >> bit) & 1) << (2 * bit)) | ((unsigned long long)((h >> bit) & 1) << (2 * bit + 1));
+		return key;
+	}
+
+	// Sort the shuffled constraints by their first node, then shuffle blocks of CONSTRAINT_BLOCK of them.
+	// A block only touches a small patch of nodes, while the block order keeps the sweep free of a
+	// preferred direction, so it converges like the fully shuffled order (see benchmark.h).
+	void orderConstraints(std::default_random_engine& rng)
+	{
+		std::stable_sort(Constraints.begin(), Constraints.end(), [](const Constraint& a, const Constraint& b)
+		{
+			return std::min(a.GetNode1(), a.GetNode2()) < std::min(b.GetNode1(), b.GetNode2());
+		});
+		int blocks = ((int)Constraints.size() + CONSTRAINT_BLOCK - 1) / CONSTRAINT_BLOCK;
+		std::vector<int> blockOrder(blocks);
+		for (int b = 0; b < blocks; b++) blockOrder[b] = b;
+		std::shuffle(blockOrder.begin(), blockOrder.end(), rng);
+		std::vector<Constraint> sorted;
+		sorted.swap(Constraints);
+		Constraints.reserve(sorted.size());
+		for (int b : blockOrder)
+			for (int c = b * CONSTRAINT_BLOCK; c < std::min((b + 1) * CONSTRAINT_BLOCK, (int)sorted.size()); c++)
+				Constraints.push_back(sorted[c]);
+	}
+
+	// One isometric bending element for every edge shared by two faces
+	void initBending()
+	{
+		std::map<std::pair<int, int>, Node*> opposite; // edge (smaller index first) -> opposite node of its first face
+		for (int i = 0; i < Faces.size() / 3; i++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				Node* n1 = Faces[3 * i + k];
+				Node* n2 = Faces[3 * i + (k + 1) % 3];
+				Node* n3 = Faces[3 * i + (k + 2) % 3];
+				std::pair<int, int> edge(std::min(n1->Index, n2->Index), std::max(n1->Index, n2->Index));
+				std::map<std::pair<int, int>, Node*>::iterator found = opposite.find(edge);
+				if (found == opposite.end()) opposite[edge] = n3;
+				else Bendings.push_back(IsometricBending(Nodes[edge.first], Nodes[edge.second], found->second, n3, Material.IsometricBendingCompliance));
+			}
+		}
+		printf("Total bending elements number: %zu\n", Bendings.size());
+	}
+
+	// Tether every free node to the nearest pinned node in the rest state, where the cloth is flat
+	// so the straight distance is also the distance along the cloth
+	void initTethers()
+	{
+		std::vector<Node*> anchors;
+		for (Node* node : Nodes)
+			if (node->InvMass == 0.0) anchors.push_back(node);
+		if (anchors.empty()) return;
+		for (Node* node : Nodes)
+		{
+			if (node->InvMass == 0.0) continue;
+			Node* nearest = anchors[0];
+			for (Node* anchor : anchors)
+				if (glm::length(anchor->Position - node->Position) < glm::length(nearest->Position - node->Position)) nearest = anchor;
+			Tethers.push_back(Tether(nearest, node, Method.TetherScale));
+		}
+		printf("Total tethers number: %zu\n", Tethers.size());
 	}
 
 	void Destroy()
 	{
-		for (int i = 0; i < Nodes.size(); i++) { delete Nodes[i]; }
 		for (int i = 0; i < Springs.size(); i++) { delete Springs[i]; }
 		Nodes.clear();
+		NodeStorage.clear();
+		NodeSlot.clear();
 		Faces.clear();
+		FaceIndices.clear();
 		Springs.clear();
 		Constraints.clear();
+		StretchConstraints.clear();
+		Tethers.clear();
+		Bendings.clear();
+		Membrane.Clear();
+		Hierarchy.Levels.clear();
 	}
 };
\ No newline at end of file
@@ -0,0 +1,564 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cloth.h"
+
+// Minimal JSON document, enough for scene files. Object members keep their order in the file.
+struct JsonValue
+{
+	enum TypeEnum { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+	TypeEnum Type = JSON_NULL;
+	bool Bool = false;
+	double Number = 0.0;
+	std::string String;
+	std::vector<JsonValue> Items;
+	std::vector<std::pair<std::string, JsonValue>> Members;
+};
+
+class JsonParser
+{
+public:
+	// false and the line of the first error if text isn't one JSON value
+	bool parse(const std::string& text, JsonValue& value, std::string& error)
+	{
+		Text = &text;
+		Position = 0;
+		Error.clear();
+		bool parsed = parseValue(value);
+		skipSpace();
+		if (parsed && Position < Text->size()) fail("unexpected characters after the value");
+		error = Error;
+		return Error.empty();
+	}
+
+private:
+	const std::string* Text = nullptr;
+	size_t Position = 0;
+	std::string Error;
+
+	bool fail(const std::string& message)
+	{
+		if (!Error.empty()) return false;
+		int line = 1;
+		for (size_t i = 0; i < Position && i < Text->size(); i++) if ((*Text)[i] == '\n') line++;
+		Error = "line " + std::to_string(line) + ": " + message;
+		return false;
+	}
+
+	void skipSpace()
+	{
+		while (Position < Text->size() && isspace((unsigned char)(*Text)[Position])) Position++;
+	}
+
+	bool consume(const char* word)
+	{
+		size_t length = strlen(word);
+		if (Text->compare(Position, length, word) != 0) return false;
+		Position += length;
+		return true;
+	}
+
+	bool parseValue(JsonValue& value)
+	{
+		skipSpace();
+		if (Position >= Text->size()) return fail("unexpected end");
+		char c = (*Text)[Position];
+		if (c == '{') return parseObject(value);
+		if (c == '[') return parseArray(value);
+		if (c == '"') { value.Type = JsonValue::JSON_STRING; return parseString(value.String); }
+		if (consume("true")) { value.Type = JsonValue::JSON_BOOL; value.Bool = true; return true; }
+		if (consume("false")) { value.Type = JsonValue::JSON_BOOL; value.Bool = false; return true; }
+		if (consume("null")) { value.Type = JsonValue::JSON_NULL; return true; }
+		const char* begin = Text->c_str() + Position;
+		char* end = nullptr;
+		value.Number = strtod(begin, &end);
+		if (end == begin) return fail("expected a value");
+		value.Type = JsonValue::JSON_NUMBER;
+		Position += end - begin;
+		return true;
+	}
+
+	bool parseString(std::string& string)
+	{
+		Position++; // opening quote
+		while (Position < Text->size() && (*Text)[Position] != '"')
+		{
+			char c = (*Text)[Position++];
+			if (c == '\\' && Position < Text->size())
+			{
+				char escaped = (*Text)[Position++];
+				c = escaped == 'n' ? '\n' : escaped == 't' ? '\t' : escaped;
+			}
+			string += c;
+		}
+		if (Position >= Text->size()) return fail("unterminated string");
+		Position++;
+		return true;
+	}
+
+	bool parseArray(JsonValue& value)
+	{
+		value.Type = JsonValue::JSON_ARRAY;
+		Position++;
+		skipSpace();
+		if (consume("]")) return true;
+		while (true)
+		{
+			value.Items.emplace_back();
+			if (!parseValue(value.Items.back())) return false;
+			skipSpace();
+			if (consume("]")) return true;
+			if (!consume(",")) return fail("expected , or ]");
+		}
+	}
+
+	bool parseObject(JsonValue& value)
+	{
+		value.Type = JsonValue::JSON_OBJECT;
+		Position++;
+		skipSpace();
+		if (consume("}")) return true;
+		while (true)
+		{
+			skipSpace();
+			value.Members.emplace_back();
+			if (Position >= Text->size() || (*Text)[Position] != '"') return fail("expected a key");
+			if (!parseString(value.Members.back().first)) return false;
+			skipSpace();
+			if (!consume(":")) return fail("expected :");
+			if (!parseValue(value.Members.back().second)) return false;
+			skipSpace();
+			if (consume("}")) return true;
+			if (!consume(",")) return fail("expected , or }");
+		}
+	}
+};
+
+// JSON text of a value, numbers with 10 significant digits
+std::string writeJson(const JsonValue& value)
+{
+	char number[32];
+	std::string text;
+	switch (value.Type)
+	{
+	case JsonValue::JSON_NULL: return "null";
+	case JsonValue::JSON_BOOL: return value.Bool ? "true" : "false";
+	case JsonValue::JSON_NUMBER:
+		snprintf(number, sizeof(number), "%.10g", value.Number);
+		return number;
+	case JsonValue::JSON_STRING: return "\"" + value.String + "\"";
+	case JsonValue::JSON_ARRAY:
+		for (const JsonValue& item : value.Items) text += (text.empty() ? "" : ",") + writeJson(item);
+		return "[" + text + "]";
+	default:
+		for (const std::pair<std::string, JsonValue>& member : value.Members)
+			text += (text.empty() ? "\"" : ",\"") + member.first + "\":" + writeJson(member.second);
+		return "{" + text + "}";
+	}
+}
+
+// One entry of "cloths", Count > 1 places copies side by side, each one Spacing further
+struct ClothConfig
+{
+	glm::vec3 Position = glm::vec3(-8, 9, -4);
+	glm::vec2 Size = glm::vec2(16, 16);
+	MethodClass Method = M_PPBD;
+	ClothMaterial Material;
+	int Count = 1;
+	glm::vec3 Spacing = glm::vec3(20, 0, 0);
+};
+
+// Scene file and command line options, replacing the compiled-in scene and the method prompts.
+//
+//   { "dt": 0.01667, "frames": 1000, "record": true, "trace": "trace.json",
+//     "cloths": [ { "method": "XPBD_Chebyshev", "iterations": 8, "nodes": [96, 96], "bendingCompliance": 0.5,
+//                   "pins": [[0, 0], [-1, 0]], "position": [-8, 9, -4], "size": [16, 16], "count": 2 },
+//                 { "method": "XPBD_Strain_Membrane", "weftCompliance": 1e-3, "position": [32, 9, -4] } ] }
+//
+// The presets keep warp and weft equally stiff, the material keys make a membrane cloth anisotropic: with a weft
+// compliance of 1e-3 the hanging cloth stretches about 7% along the weft (height) and not at all along the warp.
+// "method" picks a preset of method.h by name, keeping "nodes"; the other keys of a cloth override the preset or the material.
+// On the command line, --set key=value applies a scene key, or a cloth key to every cloth; the value is JSON or a
+// plain word. --method, --iterations, --nodes, --dt, --frames, --trace, --output and --threads are short for --set. Options apply in
+// order, so --method replaces what earlier options set on the method.
+//
+// "sweep": { "iterations": [5, 10, 20], "bendingCompliance": [0.1, 1] } or --sweep iterations=5,10,20 lists values
+// of keys; the runs of every combination are simulated without a window and summarized in Output, see sweep.h.
+class SceneConfig
+{
+public:
+	double TimeStep = 1.0 / 60.0;
+	int TotalFrame = 1000;  // frames simulated when Record is set
+	bool Record = false;    // stop after TotalFrame frames and print the timing
+	bool ShowTime = false;  // frame time and residual in the top left corner
+	bool UseLOD = false;    // simulate distant cloths on coarser grids
+	std::string TracePath;  // timeline written at exit, see trace.h
+	std::string Benchmark;  // "locality" or "counters" runs that benchmark instead of the scene, see benchmark.h
+	int Threads = -1;       // of the thread pool including the main thread, -1 is one per core (1 for the counter benchmark)
+	std::vector<std::pair<std::string, std::vector<JsonValue>>> Sweep; // keys and their values, in the order given
+	std::string Output = "sweep.csv"; // results of a sweep
+	std::vector<ClothConfig> Cloths = { ClothConfig() };
+	bool Configured = false; // a scene file or an option was given, the method is not asked for
+
+	bool load(const std::string& path)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			printf("Can't read the scene file %s\n", path.c_str());
+			return false;
+		}
+		std::stringstream text;
+		text << file.rdbuf();
+		JsonValue root;
+		std::string error;
+		JsonParser parser;
+		if (!parser.parse(text.str(), root, error))
+		{
+			printf("%s, %s\n", path.c_str(), error.c_str());
+			return false;
+		}
+		if (root.Type != JsonValue::JSON_OBJECT) return invalid(path, "the scene has to be an object");
+		for (std::pair<std::string, JsonValue>& member : root.Members)
+		{
+			if (member.first == "cloths")
+			{
+				if (member.second.Type != JsonValue::JSON_ARRAY || member.second.Items.empty())
+					return invalid(path, "cloths has to be a non empty array");
+				Cloths.clear();
+				for (JsonValue& item : member.second.Items)
+				{
+					if (item.Type != JsonValue::JSON_OBJECT) return invalid(path, "every cloth has to be an object");
+					Cloths.push_back(ClothConfig());
+					if (!setCloth(Cloths.back(), item)) return false;
+				}
+			}
+			else if (member.first == "sweep")
+			{
+				if (member.second.Type != JsonValue::JSON_OBJECT) return invalid(path, "sweep has to be an object");
+				for (std::pair<std::string, JsonValue>& axis : member.second.Members)
+				{
+					if (axis.second.Type != JsonValue::JSON_ARRAY || axis.second.Items.empty())
+						return invalid(axis.first, "the values of a sweep have to be a non empty array");
+					if (!addSweep(axis.first, axis.second.Items)) return false;
+				}
+			}
+			else if (!setScene(member.first, member.second)) return false;
+		}
+		Configured = true;
+		return true;
+	}
+
+	// key=value, value is JSON or else a plain string
+	bool set(const std::string& assignment)
+	{
+		std::string key, text;
+		if (!splitAssignment(assignment, key, text)) return false;
+		return set(key, parseWord(text));
+	}
+
+	bool set(const std::string& key, const JsonValue& value)
+	{
+		Configured = true;
+		if (isSceneKey(key)) return setScene(key, value);
+		for (ClothConfig& cloth : Cloths)
+			if (!setClothValue(cloth, key, value) || !checkPins(cloth)) return false;
+		return true;
+	}
+
+	// key=value1,value2,... for --sweep, commas inside brackets belong to the value
+	bool addSweep(const std::string& assignment)
+	{
+		std::string key, text;
+		if (!splitAssignment(assignment, key, text)) return false;
+		std::vector<JsonValue> values;
+		int depth = 0;
+		size_t begin = 0;
+		for (size_t i = 0; i <= text.size(); i++)
+		{
+			if (i == text.size() || (text[i] == ',' && depth == 0))
+			{
+				values.push_back(parseWord(text.substr(begin, i - begin)));
+				begin = i + 1;
+			}
+			else if (text[i] == '[' || text[i] == '{') depth++;
+			else if (text[i] == ']' || text[i] == '}') depth--;
+		}
+		return addSweep(key, values);
+	}
+
+	// every value is tried once, so a typo fails before any run
+	bool addSweep(const std::string& key, const std::vector<JsonValue>& values)
+	{
+		if (key == "threads") return invalid(key, "the thread count is shared by all runs of a sweep");
+		for (const JsonValue& value : values)
+		{
+			SceneConfig scratch = *this;
+			if (!scratch.set(key, value)) return false;
+		}
+		Sweep.push_back(std::make_pair(key, values));
+		Configured = true;
+		return true;
+	}
+
+	bool parseArguments(int argc, const char* argv[])
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string option = argv[i];
+			bool hasValue = i + 1 < argc;
+			if (option == "--benchmark")
+			{
+				Benchmark = "locality";
+				if (hasValue && std::string(argv[i + 1]) == "counters") Benchmark = argv[++i];
+				continue;
+			}
+			if (!hasValue)
+			{
+				printf("%s needs a value\n", option.c_str());
+				return false;
+			}
+			std::string value = argv[++i];
+			bool parsed;
+			if (option == "--scene") parsed = load(value);
+			else if (option == "--set") parsed = set(value);
+			else if (option == "--sweep") parsed = addSweep(value);
+			else if (option == "--method" || option == "--iterations" || option == "--nodes" || option == "--dt"
+				|| option == "--frames" || option == "--trace" || option == "--output" || option == "--threads")
+				parsed = set(option.substr(2) + "=" + value);
+			else
+			{
+				printf("Unknown option %s\n", option.c_str());
+				parsed = false;
+			}
+			if (!parsed) return false;
+		}
+		return true;
+	}
+
+private:
+	static bool invalid(const std::string& where, const std::string& message)
+	{
+		printf("%s: %s\n", where.c_str(), message.c_str());
+		return false;
+	}
+
+	static bool isSceneKey(const std::string& key)
+	{
+		return key == "dt" || key == "frames" || key == "record" || key == "showTime" || key == "lod" || key == "trace" || key == "output" || key == "threads";
+	}
+
+	static bool splitAssignment(const std::string& assignment, std::string& key, std::string& text)
+	{
+		size_t split = assignment.find('=');
+		if (split == std::string::npos)
+		{
+			printf("Expected key=value instead of %s\n", assignment.c_str());
+			return false;
+		}
+		key = assignment.substr(0, split);
+		text = assignment.substr(split + 1);
+		return true;
+	}
+
+	// JSON, or else the text as a string so names need no quotes on the command line
+	static JsonValue parseWord(const std::string& text)
+	{
+		JsonValue value;
+		std::string error;
+		JsonParser parser;
+		if (parser.parse(text, value, error)) return value;
+		value = JsonValue();
+		value.Type = JsonValue::JSON_STRING;
+		value.String = text;
+		return value;
+	}
+
+	bool setScene(const std::string& key, const JsonValue& value)
+	{
+		bool valid;
+		if (key == "dt") valid = getNumber(value, TimeStep) && TimeStep > 0.0;
+		else if (key == "frames") valid = getInt(value, TotalFrame) && TotalFrame > 0;
+		else if (key == "record") valid = getBool(value, Record);
+		else if (key == "showTime") valid = getBool(value, ShowTime);
+		else if (key == "lod") valid = getBool(value, UseLOD);
+		else if (key == "trace") valid = getString(value, TracePath);
+		else if (key == "output") valid = getString(value, Output);
+		else if (key == "threads") valid = getInt(value, Threads) && (Threads >= 1 || Threads == -1);
+		else return invalid(key, "unknown scene key");
+		return valid || invalid(key, "invalid value");
+	}
+
+	// the preset first, so the other keys override it whatever their order
+	bool setCloth(ClothConfig& cloth, const JsonValue& object)
+	{
+		for (const std::pair<std::string, JsonValue>& member : object.Members)
+			if (member.first == "method" && !setClothValue(cloth, member.first, member.second)) return false;
+		for (const std::pair<std::string, JsonValue>& member : object.Members)
+			if (member.first != "method" && !setClothValue(cloth, member.first, member.second)) return false;
+		return checkPins(cloth);
+	}
+
+	// after all keys of a cloth, since "nodes" may come after "pins"
+	static bool checkPins(ClothConfig& cloth)
+	{
+		glm::ivec2 grid(cloth.Method.MethodClothNodesNumber);
+		for (glm::ivec2& pin : cloth.Material.Pins)
+		{
+			if (ClothMaterial::isInGrid(pin, grid)) continue;
+			return invalid("pins", "[" + std::to_string(pin.x) + ", " + std::to_string(pin.y) + "] is outside the " +
+				std::to_string(grid.x) + " x " + std::to_string(grid.y) + " grid");
+		}
+		return true;
+	}
+
+	bool setClothValue(ClothConfig& cloth, const std::string& key, const JsonValue& value)
+	{
+		MethodClass& method = cloth.Method;
+		ClothMaterial& material = cloth.Material;
+		std::string name;
+		bool valid;
+		if (key == "method")
+		{
+			valid = getString(value, name);
+			MethodClass* preset = findPreset(name);
+			if (preset == nullptr)
+			{
+				printf("Unknown method %s, the presets are:", name.c_str());
+				for (MethodClass* listed : MethodPresets) printf(" %s", listed->getName().c_str());
+				printf("\n");
+				return false;
+			}
+			glm::vec2 nodes = method.MethodClothNodesNumber; // the grid belongs to the scene, not to the preset
+			method = *preset;
+			method.MethodClothNodesNumber = nodes;
+		}
+		else if (key == "iterations") valid = getInt(value, method.MethodIteration) && method.MethodIteration > 0;
+		else if (key == "nodes")
+		{
+			// [w, h] or one number for a square grid
+			glm::vec2 nodes(0.0f);
+			if (value.Type == JsonValue::JSON_NUMBER) nodes = glm::vec2((float)value.Number);
+			else getVec(value, nodes);
+			valid = nodes.x >= 2 && nodes.y >= 2;
+			if (valid) method.MethodClothNodesNumber = glm::vec2(glm::ivec2(nodes));
+		}
+		else if (key == "constraintLevel") valid = getInt(value, method.ConstraintLevel);
+		else if (key == "hierarchyLevels") valid = getInt(value, method.HierarchyLevels);
+		else if (key == "solver")
+		{
+			valid = getString(value, name) && (name == "gauss_seidel" || name == "jacobi");
+			method.Solver = name == "jacobi" ? JACOBI : GAUSS_SEIDEL;
+		}
+		else if (key == "acceleration")
+		{
+			valid = getString(value, name) && (name == "none" || name == "sor" || name == "chebyshev");
+			method.Acceleration = name == "sor" ? ACCEL_SOR : name == "chebyshev" ? ACCEL_CHEBYSHEV : ACCEL_NONE;
+		}
+		else if (key == "omega") valid = getNumber(value, method.Omega);
+		else if (key == "spectralRadius") valid = getNumber(value, method.SpectralRadius);
+		else if (key == "tolerance") valid = getNumber(value, method.Tolerance);
+		else if (key == "toleranceOnMax") valid = getBool(value, method.ToleranceOnMax);
+		else if (key == "minIteration") valid = getInt(value, method.MinIteration);
+		else if (key == "trackConvergence") valid = getBool(value, method.TrackConvergence);
+		else if (key == "bending")
+		{
+			valid = getString(value, name) && (name == "distance" || name == "isometric");
+			method.Bending = name == "isometric" ? BENDING_ISOMETRIC : BENDING_DISTANCE;
+		}
+		else if (key == "membrane")
+		{
+			valid = getString(value, name) && (name == "distance" || name == "strain");
+			method.Membrane = name == "strain" ? MEMBRANE_STRAIN : MEMBRANE_DISTANCE;
+		}
+		else if (key == "strainLimit") valid = getNumber(value, method.StrainLimit);
+		else if (key == "tethers") valid = getBool(value, method.UseTethers);
+		else if (key == "tetherScale") valid = getNumber(value, method.TetherScale);
+		else if (key == "localityOrder") valid = getBool(value, method.LocalityOrder);
+		else if (key == "invMass") valid = getNumber(value, material.InvMass) && material.InvMass > 0.0;
+		else if (key == "gravity") valid = getVec(value, material.Gravity);
+		else if (key == "distanceCompliance") valid = getNumber(value, material.DistanceCompliance);
+		else if (key == "bendingCompliance") valid = getNumber(value, material.BendingCompliance);
+		else if (key == "warpCompliance") valid = getNumber(value, material.WarpCompliance);
+		else if (key == "weftCompliance") valid = getNumber(value, material.WeftCompliance);
+		else if (key == "shearCompliance") valid = getNumber(value, material.ShearCompliance);
+		else if (key == "isometricBendingCompliance") valid = getNumber(value, material.IsometricBendingCompliance);
+		else if (key == "structureCoef") valid = getNumber(value, material.StructureCoef);
+		else if (key == "shearCoef") valid = getNumber(value, material.ShearCoef);
+		else if (key == "bendingCoef") valid = getNumber(value, material.BendingCoef);
+		else if (key == "pins")
+		{
+			valid = value.Type == JsonValue::JSON_ARRAY;
+			material.Pins.clear();
+			for (const JsonValue& item : value.Items)
+			{
+				// grid indices, a fraction would be cut off silently
+				glm::vec2 pin;
+				valid = valid && getVec(item, pin) && pin == glm::vec2(glm::ivec2(pin));
+				material.Pins.push_back(glm::ivec2(pin));
+			}
+		}
+		else if (key == "position") valid = getVec(value, cloth.Position);
+		else if (key == "size") valid = getVec(value, cloth.Size);
+		else if (key == "count") valid = getInt(value, cloth.Count) && cloth.Count > 0;
+		else if (key == "spacing") valid = getVec(value, cloth.Spacing);
+		else if (key == "colliders") return invalid(key, "there are no colliders in the simulation yet");
+		else return invalid(key, "unknown cloth key");
+		if (!valid) return invalid(key, "invalid value");
+		std::string unsupported = method.getUnsupportedSetting();
+		return unsupported.empty() || invalid(key, unsupported + ", not by " + method.getName());
+	}
+
+	static MethodClass* findPreset(const std::string& name)
+	{
+		for (MethodClass* method : MethodPresets)
+			if (method->getName() == name) return method;
+		return nullptr;
+	}
+
+	static bool getNumber(const JsonValue& value, double& number)
+	{
+		if (value.Type != JsonValue::JSON_NUMBER) return false;
+		number = value.Number;
+		return true;
+	}
+
+	static bool getInt(const JsonValue& value, int& number)
+	{
+		if (value.Type != JsonValue::JSON_NUMBER || value.Number != (int)value.Number) return false;
+		number = (int)value.Number;
+		return true;
+	}
+
+	static bool getBool(const JsonValue& value, bool& boolean)
+	{
+		if (value.Type != JsonValue::JSON_BOOL) return false;
+		boolean = value.Bool;
+		return true;
+	}
+
+	static bool getString(const JsonValue& value, std::string& string)
+	{
+		if (value.Type != JsonValue::JSON_STRING) return false;
+		string = value.String;
+		return true;
+	}
+
+	template<glm::length_t N, typename T>
+	static bool getVec(const JsonValue& value, glm::vec<N, T>& vector)
+	{
+		if (value.Type != JsonValue::JSON_ARRAY || value.Items.size() != N) return false;
+		for (int i = 0; i < N; i++)
+		{
+			if (value.Items[i].Type != JsonValue::JSON_NUMBER) return false;
+			vector[i] = (T)value.Items[i].Number;
+		}
+		return true;
+	}
+};
@@ -3,66 +3,142 @@
 #include "method.h"
 
 // for PBD and XPBD
+// Packed for the hottest loop of the position based solvers: the two nodes are indices into the
+// cloth's contiguous node array and invMass1 + invMass2 is stored at build time, so a projection
+// touches 40 bytes of the constraint and the two node positions. The masses must not change after
+// the constraint is built, and a constraint between two pinned nodes must not be built at all.
 class Constraint
 {
 private:
+	int         Node1;
+	int         Node2;
 	GLdouble    RestLength;
-	Node* Node1;
-	Node* Node2;
-	GLdouble    Stiffness;   // for PBD (0.0f - 1.0f)
+	GLdouble    WeightSum;   // invMass1 + invMass2
 	GLdouble    Compliance;  // for XPBD
 	GLdouble    Lambda;      // for XPBD
 
 public:
-	Constraint(Node* n1, Node* n2) :
-		RestLength(0.0f), Node1(n1), Node2(n2),
-		Stiffness(0.1f), Compliance(0.0f), Lambda(0.0f)
-	{
-		glm::vec3 n1_to_n2 = Node2->Position - Node1->Position;
-		RestLength = glm::length(n1_to_n2);
-	}
+	static constexpr GLdouble PBD_STIFFNESS = 0.2f; // for PBD (0.0 - 1.0)
+
 	Constraint(Node* n1, Node* n2, GLdouble compliance) :
-		RestLength(0.0f), Node1(n1), Node2(n2),
-		Stiffness(0.2f), Lambda(0.0f)
+		Node1(n1->Index), Node2(n2->Index), WeightSum(n1->InvMass + n2->InvMass),
+		Compliance(compliance), Lambda(0.0f)
 	{
-		glm::vec3 n1_to_n2 = Node2->Position - Node1->Position;
+		glm::vec3 n1_to_n2 = n2->Position - n1->Position;
 		RestLength = glm::length(n1_to_n2);
-		Compliance = compliance;
 	}
 
+	// false for two pinned nodes, whose constraint could never move anything
+	static bool IsNeeded(Node* n1, Node* n2) { return n1->InvMass + n2->InvMass > 0.0; }
+
 	void SetLambda(GLdouble val) { Lambda = val; }
 
-	GLdouble GetStiffness() { return Stiffness; }
-	GLdouble SetStiffness(GLdouble s) { Stiffness = s; }
+	GLdouble GetRestLength() { return RestLength; }
+	void SetRestLength(GLdouble length) { RestLength = length; }
+	GLdouble GetCompliance() { return Compliance; }
+	GLdouble GetCurrentLength(Node* nodes) { return glm::length(nodes[Node2].Position - nodes[Node1].Position); }
+	int GetNode1() const { return Node1; }
+	int GetNode2() const { return Node2; }
 
-	void Solve(GLdouble dt, MethodEnum method)
+	// Compute the correction of this constraint: Node1 should move by invMass1 * deltaPosition and
+	// Node2 by -invMass2 * deltaPosition. omega scales the correction (successive over-relaxation).
+	// inverseDtSquare is 1 / dt^2 of the current (sub)step, computed once by the caller.
+	// Returns the constraint value C_j(x) before the correction.
+	// Compiled per method, so the loops over the constraints don't branch on it.
+	template<MethodEnum Method>
+	GLdouble Project(Node* nodes, GLdouble inverseDtSquare, GLdouble omega, glm::vec<3, double>& deltaPosition)
 	{
-		GLdouble invMass1 = Node1->InvMass, invMass2 = Node2->InvMass;
-		if (invMass1 + invMass2 == 0.0f) return;
-		glm::vec<3, double> p2_to_p1 = Node1->Position - Node2->Position;
+		static_assert(Method == XPBD || Method == PBD || Method == XPBD_SS, "constraints are projected by PBD, XPBD and XPBD_SS only");
+		glm::vec<3, double> p2_to_p1 = nodes[Node1].Position - nodes[Node2].Position;
 		GLdouble dist = glm::length(p2_to_p1);
-		if (dist == 0.0f) return;
+		if (dist == 0.0f)
+		{
+			deltaPosition = glm::vec<3, double>(0.0, 0.0, 0.0);
+			return 0.0;
+		}
 		GLdouble constraint = dist - RestLength; // C_j(x)
-		glm::vec<3, double> deltaPosition;
 		GLdouble deltaLambda, alpha;
-		switch (method)
+		if constexpr (Method == XPBD) // trivial XPBD
 		{
-			case XPBD: // trivial XPBD
-				alpha = Compliance / (dt * dt); // \tilde{alpha}
-				// Note: zero compliance for cloth
-				deltaLambda = (-constraint - alpha * Lambda) / ((invMass1 + invMass2) + alpha); // equation (18)
-				deltaPosition = deltaLambda * p2_to_p1 / (dist + FLT_EPSILON); // equation (17)
-				Lambda += deltaLambda;
-				break;
-			case PBD:
-				p2_to_p1 = glm::normalize(p2_to_p1);  deltaPosition = Stiffness * p2_to_p1 * -constraint / (invMass1 + invMass2);
-				break;
-			case XPBD_SS: // XPBD with small step, lambda is set to 0.0 every step, so no lambda at all
-				alpha = Compliance / (dt * dt); // \tilde{alpha}
-				deltaLambda = -constraint / ((invMass1 + invMass2) + alpha);
-				deltaPosition = deltaLambda * p2_to_p1 / (dist + FLT_EPSILON);
+			alpha = Compliance * inverseDtSquare; // \tilde{alpha}
+			// Note: zero compliance for cloth
+			deltaLambda = omega * (-constraint - alpha * Lambda) / (WeightSum + alpha); // equation (18)
+			deltaPosition = deltaLambda * p2_to_p1 / (dist + FLT_EPSILON); // equation (17)
+			Lambda += deltaLambda;
 		}
-		Node1->Position += (invMass1 * deltaPosition);
-		Node2->Position += (-invMass2 * deltaPosition);
+		else if constexpr (Method == PBD)
+		{
+			p2_to_p1 = glm::normalize(p2_to_p1);  deltaPosition = omega * PBD_STIFFNESS * p2_to_p1 * -constraint / WeightSum;
+		}
+		else // XPBD with small step, lambda is set to 0.0 every step, so no lambda at all
+		{
+			alpha = Compliance * inverseDtSquare; // \tilde{alpha}
+			deltaLambda = omega * -constraint / (WeightSum + alpha);
+			deltaPosition = deltaLambda * p2_to_p1 / (dist + FLT_EPSILON);
+		}
+		return constraint;
+	}
+
+	// Gauss-Seidel: the correction is applied at once
+	template<MethodEnum Method>
+	GLdouble Solve(Node* nodes, GLdouble inverseDtSquare, GLdouble omega = 1.0)
+	{
+		glm::vec<3, double> deltaPosition;
+		GLdouble constraint = Project<Method>(nodes, inverseDtSquare, omega, deltaPosition);
+		Node& node1 = nodes[Node1];
+		Node& node2 = nodes[Node2];
+		node1.Position += (node1.InvMass * deltaPosition);
+		node2.Position += (-node2.InvMass * deltaPosition);
+		return constraint;
+	}
+
+	// Unilateral Gauss-Seidel for the coarse levels of ConstraintHierarchy: only a stretched constraint pulls its
+	// nodes together, so distant nodes may still come closer when the cloth folds or bunches. Returns the
+	// constraint value, 0 if the constraint is slack.
+	template<MethodEnum Method>
+	GLdouble SolveStretch(Node* nodes, GLdouble inverseDtSquare)
+	{
+		if (GetCurrentLength(nodes) <= RestLength) return 0.0;
+		return Solve<Method>(nodes, inverseDtSquare);
+	}
+
+	// Jacobi: the nodes are not touched, deltaPosition goes to this constraint's slot of a correction buffer
+	// and the cloth gathers the buffer per node after the whole sweep. Only reads shared data, so all
+	// constraints of a sweep can run in parallel.
+	template<MethodEnum Method>
+	GLdouble SolveJacobi(Node* nodes, GLdouble inverseDtSquare, glm::vec<3, double>& deltaPosition)
+	{
+		return Project<Method>(nodes, inverseDtSquare, 1.0, deltaPosition);
+	}
+};
+
+// Long range attachment (Kim et al. 2012): a free node may not get farther from a pinned node than
+// its rest distance to it. The constraint is unilateral and only the free node moves, so a tether
+// bounds the stretch of the whole chain of constraints in between with a single projection.
+class Tether
+{
+private:
+	Node* Anchor; // pinned
+	Node* Target; // free
+	GLdouble MaxLength;
+
+public:
+	Tether(Node* anchor, Node* target, GLdouble scale = 1.0) : Anchor(anchor), Target(target)
+	{
+		MaxLength = scale * glm::length(Target->Position - Anchor->Position);
+	}
+
+	GLdouble GetMaxLength() { return MaxLength; }
+	void SetMaxLength(GLdouble length) { MaxLength = length; }
+	GLdouble GetCurrentLength() { return glm::length(Target->Position - Anchor->Position); }
+
+	// Returns the relative violation before the projection, 0 if the tether is slack
+	GLdouble Solve()
+	{
+		glm::vec<3, double> anchor_to_target = Target->Position - Anchor->Position;
+		GLdouble dist = glm::length(anchor_to_target);
+		if (dist <= MaxLength) return 0.0;
+		Target->Position -= (dist - MaxLength) * anchor_to_target / dist;
+		return (dist - MaxLength) / MaxLength;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,171 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "node.h"
+#include "constraint.h"
+#include "parallel.h"
+
+// Hierarchical constraint solver for the regular cloth grid (in the spirit of hierarchical PBD).
+// Coarse level l keeps every 2^l-th column and row of the grid (always including the last ones,
+// so pinned corners stay in every level) and connects them with distance constraints at their
+// rest lengths. The coarse constraints only resist stretching (Constraint::SolveStretch): the
+// straight rest distance between nodes 2^l apart is an upper bound, since the fine path in between
+// may fold. Coarse levels are solved first, since one coarse sweep carries a correction 2^l
+// nodes far, then the displacement of the coarse nodes is bilinearly prolongated to the rest.
+class ConstraintHierarchy
+{
+public:
+	struct Level
+	{
+		std::vector<int> Columns, Rows;          // grid coordinates of the coarse nodes
+		std::vector<int> ColumnCell, RowCell;    // coarse cell of every fine column / row
+		std::vector<GLdouble> ColumnWeight, RowWeight;
+		std::vector<Constraint> Constraints;
+		std::vector<glm::vec<3, GLdouble>> SavedPosition; // coarse node positions before the solve
+	};
+	std::vector<Level> Levels; // Levels[0] is the finest coarse level (every 2nd node)
+
+	// nodes is the contiguous node array of the cloth, the constraints index into it,
+	// nodeSlot gives the position in nodes of every grid node h * nodesInWidth + w
+	void Build(Node* nodes, std::vector<int>& nodeSlot, int nodesInWidth, int nodesInHeight, int levelNumber, GLdouble compliance)
+	{
+		Levels.clear();
+		Nodes = nodes;
+		NodeSlot = &nodeSlot;
+		NodesInWidth = nodesInWidth;
+		NodesInHeight = nodesInHeight;
+		for (int l = 1; l <= levelNumber; l++)
+		{
+			int stride = 1 << l;
+			Level level;
+			level.Columns = makeLattice(NodesInWidth, stride);
+			level.Rows = makeLattice(NodesInHeight, stride);
+			if (level.Columns.size() < 3 || level.Rows.size() < 3) break;
+			makeCells(level.Columns, NodesInWidth, level.ColumnCell, level.ColumnWeight);
+			makeCells(level.Rows, NodesInHeight, level.RowCell, level.RowWeight);
+
+			int cw = (int)level.Columns.size(), ch = (int)level.Rows.size();
+			for (int i = 0; i < cw; i++)
+			{
+				for (int j = 0; j < ch; j++)
+				{
+					Node* node = getCoarseNode(level, i, j);
+					if (i < cw - 1) addConstraint(level, node, getCoarseNode(level, i + 1, j), compliance);
+					if (j < ch - 1) addConstraint(level, node, getCoarseNode(level, i, j + 1), compliance);
+					if (i < cw - 1 && j < ch - 1)
+					{
+						addConstraint(level, getCoarseNode(level, i + 1, j), getCoarseNode(level, i, j + 1), compliance);
+						addConstraint(level, node, getCoarseNode(level, i + 1, j + 1), compliance);
+					}
+				}
+			}
+			level.SavedPosition.resize(cw * ch);
+			Levels.push_back(level);
+		}
+	}
+
+	// Solve all coarse levels from the coarsest one, up to method.MethodIteration sweeps each. With a
+	// method.Tolerance, a level stops like the cloth grid does once its residual is below it. Returns the
+	// number of constraint projections done, so the caller can count the coarse work.
+	template<MethodEnum Method>
+	long long Solve(GLdouble dt, const MethodClass& method)
+	{
+		GLdouble inverseDtSquare = 1.0 / (dt * dt);
+		long long projections = 0;
+		for (int l = (int)Levels.size() - 1; l >= 0; l--)
+		{
+			Level& level = Levels[l];
+			int cw = (int)level.Columns.size(), ch = (int)level.Rows.size();
+			for (int j = 0; j < ch; j++)
+				for (int i = 0; i < cw; i++)
+					level.SavedPosition[j * cw + i] = getCoarseNode(level, i, j)->Position;
+
+			for (int i = 0; i < level.Constraints.size(); i++)
+				level.Constraints[i].SetLambda(0.0);
+			for (int n = 0; n < method.MethodIteration; n++)
+			{
+				// residual |C| / RestLength met during the sweep, 0 for a slack constraint
+				GLdouble maxResidual = 0.0, squareResidual = 0.0;
+				for (int i = 0; i < level.Constraints.size(); i++)
+				{
+					Constraint& constraint = level.Constraints[i];
+					GLdouble residual = constraint.SolveStretch<Method>(Nodes, inverseDtSquare) / constraint.GetRestLength();
+					maxResidual = std::max(maxResidual, residual);
+					squareResidual += residual * residual;
+				}
+				projections += level.Constraints.size();
+				GLdouble rmsResidual = level.Constraints.empty() ? 0.0 : std::sqrt(squareResidual / level.Constraints.size());
+				if (method.Tolerance > 0.0 && n + 1 >= method.MinIteration
+					&& (method.ToleranceOnMax ? maxResidual : rmsResidual) < method.Tolerance)
+					break;
+			}
+
+			prolongate(level);
+		}
+		return projections;
+	}
+
+private:
+	Node* Nodes = nullptr;
+	std::vector<int>* NodeSlot = nullptr;
+	int NodesInWidth = 0, NodesInHeight = 0;
+
+	Node* getNode(int w, int h) { return &Nodes[(*NodeSlot)[h * NodesInWidth + w]]; }
+	Node* getCoarseNode(Level& level, int i, int j) { return getNode(level.Columns[i], level.Rows[j]); }
+
+	static void addConstraint(Level& level, Node* n1, Node* n2, GLdouble compliance)
+	{
+		if (Constraint::IsNeeded(n1, n2)) level.Constraints.push_back(Constraint(n1, n2, compliance));
+	}
+
+	static std::vector<int> makeLattice(int count, int stride)
+	{
+		std::vector<int> lattice;
+		for (int i = 0; i < count; i += stride) lattice.push_back(i);
+		if (lattice.back() != count - 1) lattice.push_back(count - 1);
+		return lattice;
+	}
+
+	static void makeCells(std::vector<int>& lattice, int count, std::vector<int>& cell, std::vector<GLdouble>& weight)
+	{
+		cell.resize(count);
+		weight.resize(count);
+		int c = 0;
+		for (int i = 0; i < count; i++)
+		{
+			while (c + 2 < lattice.size() && lattice[c + 1] <= i) c++;
+			cell[i] = c;
+			weight[i] = (GLdouble)(i - lattice[c]) / (lattice[c + 1] - lattice[c]);
+		}
+	}
+
+	// Move every fine node by the bilinear interpolation of its coarse cell's displacement
+	void prolongate(Level& level)
+	{
+		int cw = (int)level.Columns.size();
+		std::vector<glm::vec<3, GLdouble>> delta(level.SavedPosition.size());
+		for (int j = 0; j < level.Rows.size(); j++)
+			for (int i = 0; i < cw; i++)
+				delta[j * cw + i] = getCoarseNode(level, i, j)->Position - level.SavedPosition[j * cw + i];
+
+		threadPool.ParallelFor(0, NodesInHeight, [&](int h)
+		{
+			int j = level.RowCell[h];
+			GLdouble fy = level.RowWeight[h];
+			bool onRow = level.Rows[j] == h || level.Rows[j + 1] == h;
+			for (int w = 0; w < NodesInWidth; w++)
+			{
+				int i = level.ColumnCell[w];
+				GLdouble fx = level.ColumnWeight[w];
+				bool onColumn = level.Columns[i] == w || level.Columns[i + 1] == w;
+				if (onRow && onColumn) continue; // a coarse node, already solved
+				Node* node = getNode(w, h);
+				if (node->InvMass == 0.0) continue;
+				int k = j * cw + i;
+				node->Position += (delta[k] * (1.0 - fx) + delta[k + 1] * fx) * (1.0 - fy)
+								+ (delta[k + cw] * (1.0 - fx) + delta[k + cw + 1] * fx) * fy;
+			}
+		});
+	}
+};
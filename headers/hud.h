@@ -0,0 +1,211 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include "renderer.h"
+#include "stats.h"
+
+// Rolling graphs of the last HISTORY frames in the top right corner of the window: the time of the solver
+// and of the render phases, the iterations, the residual and the simulated nodes per second. Times and nodes are
+// summed over the cloths of the scene, iterations and residual are those of the slowest cloth (Scene::getWorstStats).
+// All graphs are one vertex upload and two draw calls, the labels are one TextRenderer batch and are
+// only formatted again every LABEL_FRAMES frames.
+class PerformanceHUD
+{
+public:
+	enum SeriesEnum
+	{
+		HUD_SOLVER,
+		HUD_NORMALS,
+		HUD_UPLOAD,
+		HUD_DRAW,
+		HUD_ITERATIONS,
+		HUD_RESIDUAL,       // log10 of the RMS residual
+		HUD_NODES_PER_SECOND, // millions of nodes simulated per second of solver time
+		HUD_SERIES_NUMBER
+	};
+
+	bool Visible = false;
+
+	void init()
+	{
+		shader = Shader(HUD_VERTEX_PATH.c_str(), HUD_FRAGMENT_PATH.c_str());
+		shader.use();
+		shader.setMat4("projection", glm::ortho(0.0f, static_cast<float>(WIDTH), 0.0f, static_cast<float>(HEIGHT)));
+		glUseProgram(0);
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(HUDVertex), (void*)offsetof(HUDVertex, Position));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(HUDVertex), (void*)offsetof(HUDVertex, Color));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+
+		for (std::vector<float>& series : History) series.assign(HISTORY, 0.0f);
+	}
+
+	// One simulated frame, solverTime in ms, solver of the slowest of clothCount cloths
+	void record(double solverTime, const RenderStats& render, const SolverStats& solver, int nodeCount, int clothCount)
+	{
+		ClothCount = clothCount;
+		float value[HUD_SERIES_NUMBER];
+		value[HUD_SOLVER] = (float)solverTime;
+		value[HUD_NORMALS] = (float)render.NormalTime;
+		value[HUD_UPLOAD] = (float)render.UploadTime;
+		value[HUD_DRAW] = (float)render.DrawTime;
+		value[HUD_ITERATIONS] = (float)solver.Iterations;
+		value[HUD_RESIDUAL] = solver.RmsResidual > 0.0 ? (float)std::log10(solver.RmsResidual) : -16.0f;
+		value[HUD_NODES_PER_SECOND] = solverTime > 0.0 ? (float)(nodeCount / (solverTime * 1000.0)) : 0.0f;
+		for (int s = 0; s < HUD_SERIES_NUMBER; s++) History[s][Newest] = value[s];
+		Newest = (Newest + 1) % HISTORY;
+		Recorded = std::min(Recorded + 1, HISTORY);
+	}
+
+	void render(TextRenderer& text)
+	{
+		if (!Visible) return;
+		bool newLabels = Frame++ % LABEL_FRAMES == 0;
+		Vertices.clear();
+		LineFirst.clear();
+		LineCount.clear();
+
+		// the panels first, they are drawn as triangles before all the line strips
+		for (int p = 0; p < PANEL_NUMBER; p++)
+		{
+			float x0 = PANEL_X, y0 = panelBottom(p), x1 = PANEL_X + PANEL_WIDTH, y1 = y0 + PANEL_HEIGHT;
+			glm::vec4 color(0.0f, 0.0f, 0.0f, 0.5f);
+			Vertices.insert(Vertices.end(), { { glm::vec2(x0, y0), color }, { glm::vec2(x1, y0), color }, { glm::vec2(x1, y1), color },
+											  { glm::vec2(x0, y0), color }, { glm::vec2(x1, y1), color }, { glm::vec2(x0, y1), color } });
+		}
+		int panelVertices = (int)Vertices.size();
+
+		for (int p = 0; p < PANEL_NUMBER; p++)
+		{
+			const Panel& panel = PANELS[p];
+			float low = 0.0f, high = 0.0f;
+			range(panel, low, high);
+			for (int s = panel.First; s < panel.First + panel.Count; s++) addGraph(s, panelBottom(p), low, high);
+			if (newLabels) formatLabel(p, low, high);
+		}
+
+		/** draw **/
+		glDisable(GL_DEPTH_TEST);
+		shader.use();
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, Vertices.size() * sizeof(HUDVertex), Vertices.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDrawArrays(GL_TRIANGLES, 0, panelVertices);
+		glMultiDrawArrays(GL_LINE_STRIP, LineFirst.data(), LineCount.data(), (GLsizei)LineFirst.size());
+		glBindVertexArray(0);
+		glUseProgram(0);
+
+		for (int p = 0; p < PANEL_NUMBER; p++)
+			text.AddText(Labels[p], PANEL_X + 6.0f, panelBottom(p) + PANEL_HEIGHT - 16.0f, LABEL_SCALE, glm::vec3(1.0f));
+		text.Flush();
+		glEnable(GL_DEPTH_TEST);
+		/** end of draw **/
+	}
+
+private:
+	static constexpr int HISTORY = 240;
+	static constexpr int LABEL_FRAMES = 15;
+	static constexpr int PANEL_NUMBER = 4;
+	const float PANEL_WIDTH = 300.0f, PANEL_HEIGHT = 70.0f, PANEL_GAP = 8.0f;
+	const float PANEL_X = WIDTH - 310.0f;
+	const float LABEL_SCALE = 0.5f;
+
+	// a panel draws Count series from First on one vertical scale
+	struct Panel
+	{
+		int First, Count;
+		bool FromZero; // else the scale spans from the lowest to the highest value
+	};
+	const Panel PANELS[PANEL_NUMBER] = {
+		{ HUD_SOLVER, 4, true },
+		{ HUD_ITERATIONS, 1, true },
+		{ HUD_RESIDUAL, 1, false },
+		{ HUD_NODES_PER_SECOND, 1, true }
+	};
+	const glm::vec4 COLORS[HUD_SERIES_NUMBER] = {
+		glm::vec4(1.0f, 0.4f, 0.3f, 1.0f), glm::vec4(0.4f, 1.0f, 0.4f, 1.0f), glm::vec4(0.4f, 0.7f, 1.0f, 1.0f), glm::vec4(1.0f, 1.0f, 0.4f, 1.0f),
+		glm::vec4(1.0f, 0.6f, 1.0f, 1.0f), glm::vec4(0.5f, 1.0f, 1.0f, 1.0f), glm::vec4(1.0f, 0.8f, 0.5f, 1.0f)
+	};
+
+	struct HUDVertex
+	{
+		glm::vec2 Position;
+		glm::vec4 Color;
+	};
+
+	Shader shader;
+	unsigned int VAO, VBO;
+	std::vector<float> History[HUD_SERIES_NUMBER]; // ring buffers, Newest is the next slot to write
+	int Newest = 0, Recorded = 0;
+	long long Frame = 0;
+	int ClothCount = 1;
+	std::vector<HUDVertex> Vertices;
+	std::vector<GLint> LineFirst;
+	std::vector<GLsizei> LineCount;
+	std::string Labels[PANEL_NUMBER];
+
+	float panelBottom(int p) { return HEIGHT - (p + 1) * (PANEL_HEIGHT + PANEL_GAP); }
+
+	// value of series s recorded i frames ago
+	float sample(int s, int i) { return History[s][(Newest - 1 - i + HISTORY) % HISTORY]; }
+
+	void range(const Panel& panel, float& low, float& high)
+	{
+		low = 1e30f;
+		high = -1e30f;
+		for (int s = panel.First; s < panel.First + panel.Count; s++)
+			for (int i = 0; i < Recorded; i++)
+			{
+				low = std::min(low, sample(s, i));
+				high = std::max(high, sample(s, i));
+			}
+		if (Recorded == 0) low = high = 0.0f;
+		if (panel.FromZero) low = std::min(low, 0.0f);
+		if (high - low < 1e-6f) high = low + 1.0f;
+	}
+
+	// the newest sample on the right, the plot leaves the top 20 pixels of the panel to the label
+	void addGraph(int s, float bottom, float low, float high)
+	{
+		if (Recorded < 2) return;
+		float dx = PANEL_WIDTH / (HISTORY - 1), height = PANEL_HEIGHT - 24.0f, scale = height / (high - low);
+		LineFirst.push_back((GLint)Vertices.size());
+		LineCount.push_back(Recorded);
+		for (int i = Recorded - 1; i >= 0; i--)
+			Vertices.push_back({ glm::vec2(PANEL_X + PANEL_WIDTH - i * dx, bottom + 2.0f + (sample(s, i) - low) * scale), COLORS[s] });
+	}
+
+	void formatLabel(int p, float low, float high)
+	{
+		char label[128];
+		std::string worst = ClothCount > 1 ? "  worst of " + std::to_string(ClothCount) + " cloths" : "";
+		switch (p)
+		{
+		case 0:
+			snprintf(label, sizeof(label), "ms  solve %.2f  normal %.2f  upload %.2f  draw %.2f",
+				sample(HUD_SOLVER, 0), sample(HUD_NORMALS, 0), sample(HUD_UPLOAD, 0), sample(HUD_DRAW, 0));
+			break;
+		case 1:
+			snprintf(label, sizeof(label), "iterations %d  (max %d)%s", (int)sample(HUD_ITERATIONS, 0), (int)high, worst.c_str());
+			break;
+		case 2:
+			snprintf(label, sizeof(label), "residual %.2e  (%.0e .. %.0e)%s", std::pow(10.0, sample(HUD_RESIDUAL, 0)), std::pow(10.0, low), std::pow(10.0, high), worst.c_str());
+			break;
+		default:
+			snprintf(label, sizeof(label), "%.2f M nodes / s", sample(HUD_NODES_PER_SECOND, 0));
+			break;
+		}
+		Labels[p] = label;
+	}
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include "cloth.h"
+#include "camera.h"
+
+// Level of detail for one cloth.
+// Level 0 is the resolution of the cloth's method, every next level halves the number of quads.
+// The active level is chosen from the on-screen size of the cloth, computed from the camera
+// position and Zoom, and switching is done by Cloth::Resample so the state is carried over.
+class ClothLOD
+{
+private:
+	const float PIXELS_PER_NODE = 6.0f; // finest spacing worth simulating on screen
+	const float HYSTERESIS = 0.25f;     // extra margin before coarsening, avoids switching back and forth
+
+public:
+	Cloth* Target;
+	std::vector<glm::ivec2> Levels;
+	int ActiveLevel = 0;
+
+	ClothLOD(Cloth* cloth, int levelNumber = 3)
+	{
+		Target = cloth;
+		glm::ivec2 nodes(cloth->Method.MethodClothNodesNumber.x, cloth->Method.MethodClothNodesNumber.y);
+		Levels.push_back(nodes);
+		for (int l = 1; l < levelNumber; l++)
+		{
+			nodes = glm::ivec2((nodes.x - 1) / 2 + 1, (nodes.y - 1) / 2 + 1);
+			if (nodes.x < 4 || nodes.y < 4) break;
+			Levels.push_back(nodes);
+		}
+	}
+
+	// projected length of the longer cloth side in pixels
+	float getScreenSize(Camera& camera, int viewportHeight)
+	{
+		glm::vec3 center = glm::vec3(Target->ClothPosition) + glm::vec3(Target->Width * 0.5f, -Target->Height * 0.5f, 0.0f);
+		float distance = std::max(glm::length(camera.Position - center), 0.1f);
+		float visibleHeight = 2.0f * distance * tanf(glm::radians(camera.Zoom) * 0.5f);
+		return (float)std::max(Target->Width, Target->Height) / visibleHeight * viewportHeight;
+	}
+
+	void Update(Camera& camera, int viewportHeight)
+	{
+		float neededNodes = getScreenSize(camera, viewportHeight) / PIXELS_PER_NODE;
+		int level = ActiveLevel;
+		// refine as soon as the active level is too coarse
+		while (level > 0 && getNodes(level) < neededNodes) level--;
+		// coarsen only when the coarser level is still fine enough with a margin
+		while (level + 1 < Levels.size() && getNodes(level + 1) >= neededNodes * (1.0f + HYSTERESIS)) level++;
+		setLevel(level);
+	}
+
+	void setLevel(int level)
+	{
+		if (level == ActiveLevel) return;
+		ActiveLevel = level;
+		Target->Resample(Levels[level].x, Levels[level].y);
+	}
+
+private:
+	int getNodes(int level) { return std::max(Levels[level].x, Levels[level].y); }
+};
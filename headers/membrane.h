@@ -0,0 +1,186 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "node.h"
+#include "method.h"
+
+// Strain based membrane (in the spirit of Mueller et al. 2014, strain based dynamics) for PBD, XPBD and XPBD_SS.
+// Every triangle has the deformation gradient F = [x1 - x0, x2 - x0] * Dm^-1, Dm being its rest shape in the
+// cloth plane, so the columns f0 and f1 of F are the warp (width) and weft (height) directions of the material.
+// Three constraints are solved per triangle: |f0| - 1 (warp), |f1| - 1 (weft) and f0 . f1 (shear), each with
+// its own compliance scaled by the rest area, then |f0| and |f1| are hard limited to 1 + StrainLimit.
+// All data is stored per triangle in contiguous arrays, in the order of the Faces they were built from.
+class MembraneTriangles
+{
+public:
+	std::vector<Node*> TriangleNodes;       // 3 per triangle
+	std::vector<glm::dmat2> RestInverse;    // Dm^-1
+	std::vector<GLdouble> RestArea;
+	std::vector<glm::vec<3, GLdouble>> Lambda; // warp, weft and shear, for XPBD
+	std::vector<glm::vec<3, GLdouble>> RestStrain; // |f0|, |f1| and f0 . f1 at rest, (1, 1, 0) except while Cloth::Resample blends
+	GLdouble WarpCompliance = 0.0, WeftCompliance = 0.0, ShearCompliance = 0.0;
+	GLdouble StrainLimit = 0.0; // 0 means no limit
+	GLdouble Stiffness = 0.2;   // for PBD (0.0f - 1.0f)
+	static inline const glm::vec<3, GLdouble> REST_STRAIN = glm::vec<3, GLdouble>(1.0, 1.0, 0.0);
+
+	// faces are triangles, 3 nodes each, in their rest state
+	void Build(std::vector<Node*>& faces, GLdouble warpCompliance, GLdouble weftCompliance, GLdouble shearCompliance, GLdouble strainLimit)
+	{
+		Clear();
+		WarpCompliance = warpCompliance;
+		WeftCompliance = weftCompliance;
+		ShearCompliance = shearCompliance;
+		StrainLimit = strainLimit;
+		for (int i = 0; i + 2 < faces.size(); i += 3)
+		{
+			glm::vec<3, GLdouble> e1 = faces[i + 1]->Position - faces[i]->Position, e2 = faces[i + 2]->Position - faces[i]->Position;
+			glm::dmat2 restShape(e1.x, e1.y, e2.x, e2.y); // columns are the rest edges in the cloth plane
+			GLdouble area = 0.5 * std::abs(glm::determinant(restShape));
+			if (area == 0.0) continue;
+			TriangleNodes.push_back(faces[i]);
+			TriangleNodes.push_back(faces[i + 1]);
+			TriangleNodes.push_back(faces[i + 2]);
+			RestInverse.push_back(glm::inverse(restShape));
+			RestArea.push_back(area);
+		}
+		Lambda.assign(RestArea.size(), glm::vec<3, GLdouble>(0.0, 0.0, 0.0));
+		RestStrain.assign(RestArea.size(), REST_STRAIN);
+	}
+
+	void Clear()
+	{
+		TriangleNodes.clear();
+		RestInverse.clear();
+		RestArea.clear();
+		Lambda.clear();
+		RestStrain.clear();
+	}
+
+	int size() { return (int)RestArea.size(); }
+
+	// every triangle rests at its current strain, see Cloth::Resample
+	void SetRestStrainToCurrent()
+	{
+		for (int t = 0; t < RestArea.size(); t++)
+		{
+			Triangle triangle;
+			for (int j = 0; j < 3; j++) triangle.Position[j] = TriangleNodes[3 * t + j]->Position;
+			glm::vec<3, GLdouble> f0 = triangle.column(RestInverse[t], 0), f1 = triangle.column(RestInverse[t], 1);
+			RestStrain[t] = glm::vec<3, GLdouble>(glm::length(f0), glm::length(f1), glm::dot(f0, f1));
+		}
+	}
+
+	// keep is the fraction of the difference to REST_STRAIN that remains
+	void BlendRestStrain(GLdouble keep)
+	{
+		for (glm::vec<3, GLdouble>& strain : RestStrain) strain = REST_STRAIN + (strain - REST_STRAIN) * keep;
+	}
+	void ResetLambda() { std::fill(Lambda.begin(), Lambda.end(), glm::vec<3, GLdouble>(0.0, 0.0, 0.0)); }
+
+	// One Gauss-Seidel sweep over all triangles, omega scales the corrections (successive over-relaxation).
+	// Adds the warp and weft strains met before their corrections to maxResidual and squareResidual.
+	template<MethodEnum Method>
+	void Solve(GLdouble dt, GLdouble omega, GLdouble& maxResidual, GLdouble& squareResidual)
+	{
+		static_assert(Method == XPBD || Method == PBD || Method == XPBD_SS, "the membrane is solved by PBD, XPBD and XPBD_SS only");
+		for (int t = 0; t < RestArea.size(); t++)
+		{
+			// the constraints of a triangle work on local copies, written back once
+			Node** nodes = &TriangleNodes[3 * t];
+			Triangle triangle;
+			for (int j = 0; j < 3; j++)
+			{
+				triangle.Position[j] = nodes[j]->Position;
+				triangle.InvMass[j] = nodes[j]->InvMass;
+			}
+			if (triangle.InvMass[0] + triangle.InvMass[1] + triangle.InvMass[2] == 0.0) continue;
+			glm::dmat2& restInverse = RestInverse[t];
+			GLdouble alpha = 1.0 / (RestArea[t] * dt * dt);
+			glm::vec<3, GLdouble> gradient1, gradient2;
+			for (int k = 0; k < 2; k++)
+			{
+				// stretch of the warp (k = 0) or weft (k = 1) direction
+				glm::vec<3, GLdouble> f = triangle.column(restInverse, k);
+				GLdouble length = glm::length(f);
+				if (length == 0.0) continue;
+				GLdouble constraint = length - RestStrain[t][k];
+				maxResidual = std::max(maxResidual, std::abs(constraint));
+				squareResidual += constraint * constraint;
+				glm::vec<3, GLdouble> direction = f / length;
+				gradient1 = restInverse[k][0] * direction;
+				gradient2 = restInverse[k][1] * direction;
+				triangle.project<Method>(gradient1, gradient2, constraint, (k == 0 ? WarpCompliance : WeftCompliance) * alpha, Lambda[t][k], omega, Stiffness);
+			}
+			// shear
+			glm::vec<3, GLdouble> f0 = triangle.column(restInverse, 0), f1 = triangle.column(restInverse, 1);
+			gradient1 = restInverse[0][0] * f1 + restInverse[1][0] * f0;
+			gradient2 = restInverse[0][1] * f1 + restInverse[1][1] * f0;
+			triangle.project<Method>(gradient1, gradient2, glm::dot(f0, f1) - RestStrain[t][2], ShearCompliance * alpha, Lambda[t][2], omega, Stiffness);
+
+			for (int k = 0; k < 2 && StrainLimit > 0.0; k++)
+			{
+				glm::vec<3, GLdouble> f = triangle.column(restInverse, k);
+				GLdouble length = glm::length(f);
+				GLdouble limit = std::max(1.0 + StrainLimit, RestStrain[t][k]); // a blended rest strain may be above it
+				if (length <= limit) continue;
+				glm::vec<3, GLdouble> direction = f / length;
+				GLdouble unused = 0.0;
+				triangle.project<XPBD_SS>(restInverse[k][0] * direction, restInverse[k][1] * direction, length - limit, 0.0, unused, 1.0, 1.0);
+			}
+			for (int j = 0; j < 3; j++) nodes[j]->Position = triangle.Position[j];
+		}
+	}
+
+	// Mean |stretch| of the warp and weft directions
+	GLdouble getStretchError()
+	{
+		GLdouble error = 0.0;
+		for (int t = 0; t < RestArea.size(); t++)
+		{
+			Triangle triangle;
+			for (int j = 0; j < 3; j++) triangle.Position[j] = TriangleNodes[3 * t + j]->Position;
+			for (int k = 0; k < 2; k++)
+				error += std::abs(glm::length(triangle.column(RestInverse[t], k)) - 1.0);
+		}
+		return RestArea.empty() ? 0.0 : error / (2.0 * RestArea.size());
+	}
+
+private:
+	struct Triangle
+	{
+		glm::vec<3, GLdouble> Position[3];
+		GLdouble InvMass[3];
+
+		// column k of F
+		glm::vec<3, GLdouble> column(glm::dmat2& restInverse, int k)
+		{
+			return (Position[1] - Position[0]) * restInverse[k][0] + (Position[2] - Position[0]) * restInverse[k][1];
+		}
+
+		// XPBD update of one scalar constraint, the gradient of node 0 is -gradient1 - gradient2
+		// and alpha is the compliance already divided by area * dt^2
+		template<MethodEnum Method>
+		void project(glm::vec<3, GLdouble> gradient1, glm::vec<3, GLdouble> gradient2, GLdouble constraint, GLdouble alpha,
+					 GLdouble& lambda, GLdouble omega, GLdouble stiffness)
+		{
+			glm::vec<3, GLdouble> gradient0 = -gradient1 - gradient2;
+			GLdouble weightSum = InvMass[0] * glm::dot(gradient0, gradient0) + InvMass[1] * glm::dot(gradient1, gradient1)
+							   + InvMass[2] * glm::dot(gradient2, gradient2);
+			if (weightSum == 0.0) return;
+			GLdouble deltaLambda;
+			if constexpr (Method == XPBD)
+			{
+				deltaLambda = omega * (-constraint - alpha * lambda) / (weightSum + alpha);
+				lambda += deltaLambda;
+			}
+			else if constexpr (Method == PBD)
+				deltaLambda = omega * stiffness * -constraint / weightSum;
+			else
+				deltaLambda = omega * -constraint / (weightSum + alpha);
+			Position[0] += InvMass[0] * deltaLambda * gradient0;
+			Position[1] += InvMass[1] * deltaLambda * gradient1;
+			Position[2] += InvMass[2] * deltaLambda * gradient2;
+		}
+	};
+};
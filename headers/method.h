@@ -1,4 +1,6 @@
 #pragma once
+#include <vector>
+#include <string>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -11,7 +13,39 @@ enum MethodEnum
 	// all for mass-spring system
 	Verlet_Integration = 4, 
 	Explicit_Euler = 5,
-	Semi_Implicit_Euler = 6
+	Semi_Implicit_Euler = 6,
+	Implicit_Euler = 7, // backward Euler, one conjugate gradient solve per frame
+	Projective_Dynamics = 8, // local/global solve of the PBD constraints with a prefactored system matrix
+	Vertex_Block_Descent = 9 // per node Newton steps on the PBD constraints, nodes colored for parallelism
+};
+
+// how bending is modeled for PBD, XPBD and XPBD_SS
+enum BendingModelEnum
+{
+	BENDING_DISTANCE = 0, // distance constraints across two nodes, chosen by ConstraintLevel
+	BENDING_ISOMETRIC = 1 // isometric bending energy over every pair of faces sharing an edge, ConstraintLevel is ignored
+};
+
+// how in-plane stretch and shear are modeled for PBD, XPBD and XPBD_SS
+enum MembraneModelEnum
+{
+	MEMBRANE_DISTANCE = 0, // distance constraints along the grid edges and both diagonals of every quad
+	MEMBRANE_STRAIN = 1    // warp, weft and shear strain constraints on every face
+};
+
+// how a sweep over the constraints is done (XPBD, PBD and XPBD_SS)
+enum SolverEnum
+{
+	GAUSS_SEIDEL = 0, // every correction is applied at once
+	JACOBI = 1        // corrections are buffered, then averaged per node after the sweep; parallel and deterministic
+};
+
+// acceleration of the constraint iterations
+enum AccelerationEnum
+{
+	ACCEL_NONE = 0,
+	ACCEL_SOR = 1,      // successive over-relaxation, corrections are scaled by Omega
+	ACCEL_CHEBYSHEV = 2 // Chebyshev semi-iterative method, see Wang 2015
 };
 
 class MethodClass
@@ -23,6 +57,21 @@ public:
 	int MethodIteration;
 	glm::vec2 MethodClothNodesNumber;
 	int ConstraintLevel; // 0: no bending constraint, 1: only diagonal bending constraint, 2: only edge bending constraint, 3: all bending constraint
+	int HierarchyLevels = 0; // for XPBD and PBD, coarse grid levels solved before the cloth grid, 0 means plain Gauss-Seidel
+	SolverEnum Solver = GAUSS_SEIDEL;
+	AccelerationEnum Acceleration = ACCEL_NONE;
+	double Omega = 1.0;          // relaxation factor of ACCEL_SOR, (1, 2) over-relaxes
+	double SpectralRadius = 0.9; // estimated convergence rate rho of the plain iteration, for ACCEL_CHEBYSHEV
+	bool TrackConvergence = false; // record the residual of every sweep in Cloth::Stats
+	double Tolerance = 0.0;  // stop the sweeps once the relative constraint violation is below it, 0 always runs MethodIteration sweeps
+	bool ToleranceOnMax = false; // compare Tolerance with the max violation instead of the RMS one
+	int MinIteration = 1;    // sweeps always done before checking Tolerance
+	BendingModelEnum Bending = BENDING_DISTANCE;
+	MembraneModelEnum Membrane = MEMBRANE_DISTANCE;
+	double StrainLimit = 0.0; // for MEMBRANE_STRAIN, max stretch of warp and weft (0.1 is 10%), 0 means no limit
+	bool UseTethers = false; // for XPBD, PBD, XPBD_SS and Vertex_Block_Descent, attach every free node to its nearest pinned node
+	double TetherScale = 1.0; // max tether length relative to the rest distance, > 1 allows some stretch
+	bool LocalityOrder = true; // nodes stored along a Morton curve, constraints sorted by node in shuffled blocks; Projective_Dynamics keeps the row order
 
 	MethodClass(MethodEnum methodId, std::string methodName, int methodIteration, glm::vec2 methodClothNodesNumber, int constraintLevel = 0) :
 	MethodId(methodId), MethodName(methodName), MethodIteration(methodIteration), MethodClothNodesNumber(methodClothNodesNumber), ConstraintLevel(constraintLevel)
@@ -31,13 +80,70 @@ public:
 
 	MethodEnum getId() { return MethodId; }
 	std::string getName() { return MethodName; }
+	// methods solved by sweeps over the constraints
+	bool isPositionBased() { return MethodId == XPBD || MethodId == PBD || MethodId == XPBD_SS; }
+	// methods that solve the coarse levels of HierarchyLevels before every frame's sweeps, with either Solver
+	bool usesHierarchy() { return MethodId == XPBD || MethodId == PBD; }
+	bool isMassSpring()
+	{
+		return MethodId == Verlet_Integration || MethodId == Explicit_Euler || MethodId == Semi_Implicit_Euler || MethodId == Implicit_Euler;
+	}
+
+	MethodClass& setHierarchyLevels(int levels) { HierarchyLevels = levels; return *this; }
+	MethodClass& setSolver(SolverEnum solver) { Solver = solver; return *this; }
+	MethodClass& setSOR(double omega) { Acceleration = ACCEL_SOR; Omega = omega; return *this; }
+	MethodClass& setChebyshev(double spectralRadius) { Acceleration = ACCEL_CHEBYSHEV; SpectralRadius = spectralRadius; return *this; }
+	MethodClass& setTolerance(double tolerance, int minIteration) { Tolerance = tolerance; MinIteration = minIteration; return *this; }
+	MethodClass& setTethers(double scale = 1.0) { UseTethers = true; TetherScale = scale; return *this; }
+	MethodClass& setBending(BendingModelEnum bending) { Bending = bending; return *this; }
+	MethodClass& setMembrane(MembraneModelEnum membrane, double strainLimit = 0.0) { Membrane = membrane; StrainLimit = strainLimit; return *this; }
+	MethodClass& setLocalityOrder(bool localityOrder) { LocalityOrder = localityOrder; return *this; }
+
+	// why a setting can't be used by this method, empty if they all can (always for the presets)
+	std::string getUnsupportedSetting()
+	{
+		if (Bending == BENDING_ISOMETRIC && !isPositionBased()) return "isometric bending is only solved by PBD, XPBD and XPBD_SS";
+		if (HierarchyLevels > 0 && !usesHierarchy()) return "the constraint hierarchy is only solved by PBD and XPBD";
+		return "";
+	}
 };
 
 MethodClass M_PPBD(XPBD, "XPBD", 10, glm::vec2(64, 64));
 MethodClass M_PBD(PBD, "PBD", 20, glm::vec2(64, 64));
+// Hierarchical XPBD: 3 coarse levels carry corrections across the cloth, so a few iterations are enough
+MethodClass M_PPBD_Hierarchy = MethodClass(XPBD, "XPBD_Hierarchy", 4, glm::vec2(64, 64)).setHierarchyLevels(3);
+// Accelerated XPBD, reaching the same residual as XPBD with fewer iterations
+// Note: with 6 iterations, Chebyshev at rho = 0.95 has a lower residual than plain XPBD with 10, rho = 0.99 explodes
+MethodClass M_PPBD_SOR = MethodClass(XPBD, "XPBD_SOR", 8, glm::vec2(64, 64)).setSOR(1.5);
+MethodClass M_PPBD_Chebyshev = MethodClass(XPBD, "XPBD_Chebyshev", 6, glm::vec2(64, 64)).setChebyshev(0.95);
+MethodClass M_PPBD_Jacobi = MethodClass(XPBD, "XPBD_Jacobi", 20, glm::vec2(64, 64)).setSolver(JACOBI).setChebyshev(0.97);
+// Adaptive XPBD: up to 10 iterations on the cloth grid and on each coarse level, stopping below the tolerance.
+// Note: the hanging cloth stays near a 6e-3 RMS residual, so it takes 9.9 fine iterations and coarse work worth 3.1 per frame
+// Note: it needs a solver that actually converges, plain Gauss-Seidel stays above any useful tolerance on a hanging cloth
+MethodClass M_PPBD_Adaptive = MethodClass(XPBD, "XPBD_Adaptive", 10, glm::vec2(64, 64)).setHierarchyLevels(3).setTolerance(1.5e-3, 1);
+// XPBD with tethers: the pinned corners bound the stretch, 4 iterations stretch less than 10 without tethers
+MethodClass M_PPBD_Tether = MethodClass(XPBD, "XPBD_Tether", 4, glm::vec2(64, 64)).setTethers();
+// XPBD with isometric bending, 11.8k bending elements instead of 15.6k distance bending constraints (ConstraintLevel 3)
+MethodClass M_PPBD_Isometric = MethodClass(XPBD, "XPBD_Isometric_Bending", 10, glm::vec2(64, 64)).setBending(BENDING_ISOMETRIC);
+// XPBD with the strain membrane, 7.9k faces instead of 16k distance constraints, stretch limited to 10%.
+// Note: stretches less than XPBD with 10 iterations, but a face costs about as much as 5 distance constraints
+MethodClass M_PPBD_Strain = MethodClass(XPBD, "XPBD_Strain_Membrane", 10, glm::vec2(64, 64)).setMembrane(MEMBRANE_STRAIN, 0.1);
 MethodClass M_PPBD_SS(XPBD_SS, "XPBD_SS", 10, glm::vec2(64, 64));
 MethodClass M_Verlet_Integration(Verlet_Integration, "Verlet_Integration", 40, glm::vec2(64, 64));
 // Note: Explicit_Euler will explode if timestep is too small, 1/200 will only be good for several secs. 1/1200 works for 40 iteration
 //       1/600 works for 100 iteration, can't keep stable under 1/60 timestep
 MethodClass M_Explicit_Euler(Explicit_Euler, "Explicit_Euler", 100, glm::vec2(64, 64));
-MethodClass M_Semi_Implicit_Euler(Semi_Implicit_Euler, "Semi_Implicit_Euler", 40, glm::vec2(64, 64));
\ No newline at end of file
+MethodClass M_Semi_Implicit_Euler(Semi_Implicit_Euler, "Semi_Implicit_Euler", 40, glm::vec2(64, 64));
+// Note: stable at 1/60 timestep with a single step per frame, iteration is the max number of conjugate gradient iterations
+MethodClass M_Implicit_Euler(Implicit_Euler, "Implicit_Euler", 50, glm::vec2(64, 64));
+// Note: iteration is the number of local/global iterations, the system matrix is factored once for the time step.
+//       3 iterations already stretch as little as 10, the remaining stretch comes from the capped constraint stiffness
+MethodClass M_Projective_Dynamics(Projective_Dynamics, "Projective_Dynamics", 3, glm::vec2(64, 64), 3);
+// Note: a sweep visits every constraint from both nodes, so it costs about twice a XPBD sweep; with Chebyshev acceleration
+//       10 iterations stretch about half as much as XPBD with 10 iterations on the same constraints
+MethodClass M_Vertex_Block_Descent = MethodClass(Vertex_Block_Descent, "Vertex_Block_Descent", 10, glm::vec2(64, 64), 3).setChebyshev(0.95);
+
+// every preset, in the order of the method menu; scene files name them by getName (see config.h)
+std::vector<MethodClass*> MethodPresets = { &M_PPBD, &M_PBD, &M_PPBD_SS, &M_Verlet_Integration, &M_Explicit_Euler, &M_Semi_Implicit_Euler,
+	&M_PPBD_Hierarchy, &M_PPBD_SOR, &M_PPBD_Chebyshev, &M_PPBD_Jacobi, &M_PPBD_Adaptive, &M_Implicit_Euler, &M_Projective_Dynamics,
+	&M_Vertex_Block_Descent, &M_PPBD_Tether, &M_PPBD_Isometric, &M_PPBD_Strain };
@@ -10,13 +10,13 @@ class Node
 {
 public:
 	glm::vec<3, GLdouble> Position;
+	GLdouble InvMass;			          // inverse mass, i.e. w = 1 / mass, next to Position since the solvers read both
 	glm::vec<3, GLdouble> Velocity;
 	glm::vec<3, GLdouble> Acceleration;
 	glm::vec2 TextureCoord;
-	glm::vec<3, GLdouble> Normal;         // for shading
+	int Index;                            // position in Cloth::Nodes and Cloth::NodeStorage, see Cloth::NodeSlot
 
 	/** for XPBD **/
-	GLdouble InvMass;			          // inverse mass, i.e. w = 1 / mass
 	glm::vec<3, GLdouble> OldPosition;
 	/** end of for XPBD **/
 
@@ -35,8 +35,8 @@ public:
 		Velocity = glm::vec<3, GLdouble>(0.0f, 0.0f, 0.0f);
 		Acceleration = acceleration;
 		TextureCoord = glm::vec2(0.0f, 0.0f);
-		Normal = glm::vec<3, GLdouble>(0.0f, 0.0f, 0.0f);
 		InvMass = invMass;
+		Index = -1;
 		OldPosition = Position;
 		Force = glm::vec<3, double>(0, 0, 0);
 	}
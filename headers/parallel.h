@@ -0,0 +1,149 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include "trace.h"
+
+// A small persistent thread pool shared by the whole simulation.
+// ParallelFor splits [begin, end) into fixed chunks, the calling thread joins the work,
+// and a call made from inside a worker simply runs serially (no nested parallelism).
+class ThreadPool
+{
+private:
+	std::vector<std::thread> Workers;
+	std::mutex CallMutex; // one job at a time when several threads share the pool
+	std::mutex Mutex;
+	std::condition_variable WakeUp;
+	std::condition_variable Finished;
+	bool Stop = false;
+
+	/** current job **/
+	std::function<void(int, int)> Job;
+	int JobBegin = 0, JobEnd = 0, JobChunk = 1;
+	std::atomic<int> NextChunk{ 0 };
+	int ActiveWorkers = 0;
+	unsigned int JobGeneration = 0;
+	/** end of current job **/
+
+	static bool& insideWorker()
+	{
+		static thread_local bool inside = false;
+		return inside;
+	}
+
+public:
+	ThreadPool(int threadCount = -1) { startWorkers(threadCount); }
+	~ThreadPool() { stopWorkers(); }
+
+	// threads working on a ParallelFor including the calling one, -1 means one per core.
+	// Must not be called while a ParallelFor runs.
+	void setThreadCount(int threads)
+	{
+		stopWorkers();
+		startWorkers(threads < 0 ? -1 : std::max(threads, 1) - 1);
+	}
+
+	int getThreadCount() { return (int)Workers.size() + 1; }
+
+	// body(chunkBegin, chunkEnd) is called once per chunk
+	void ParallelForChunk(int begin, int end, const std::function<void(int, int)>& body, int chunk = -1)
+	{
+		if (end <= begin) return;
+		if (chunk <= 0) chunk = std::max(1, (end - begin) / (4 * getThreadCount()));
+		if (Workers.empty() || insideWorker() || end - begin <= chunk)
+		{
+			body(begin, end);
+			return;
+		}
+		std::lock_guard<std::mutex> callLock(CallMutex);
+		std::unique_lock<std::mutex> lock(Mutex);
+		Job = body;
+		JobBegin = begin;
+		JobEnd = end;
+		JobChunk = chunk;
+		NextChunk = 0;
+		ActiveWorkers = (int)Workers.size();
+		JobGeneration++;
+		lock.unlock();
+		WakeUp.notify_all();
+
+		insideWorker() = true;
+		runChunks();
+		insideWorker() = false;
+
+		lock.lock();
+		Finished.wait(lock, [this] { return ActiveWorkers == 0; });
+		Job = nullptr;
+	}
+
+	// body(i) is called for every index, chunks are still used to keep the call overhead low
+	template<typename Function>
+	void ParallelFor(int begin, int end, Function body, int chunk = -1)
+	{
+		ParallelForChunk(begin, end, [&body](int chunkBegin, int chunkEnd)
+		{
+			for (int i = chunkBegin; i < chunkEnd; i++) body(i);
+		}, chunk);
+	}
+
+private:
+	// threadCount workers besides the calling thread, -1 means hardware_concurrency() - 1
+	void startWorkers(int threadCount)
+	{
+		if (threadCount < 0) threadCount = (int)std::thread::hardware_concurrency() - 1;
+		Stop = false;
+		for (int i = 0; i < threadCount; i++)
+			Workers.emplace_back([this, i, generation = JobGeneration] { workerLoop(i, generation); });
+	}
+
+	void stopWorkers()
+	{
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Stop = true;
+		}
+		WakeUp.notify_all();
+		for (std::thread& worker : Workers) worker.join();
+		Workers.clear();
+	}
+
+	// the part of the job one thread does, one event per thread and job in the trace
+	void runChunks()
+	{
+		TRACE_SCOPE("ParallelFor task");
+		while (true)
+		{
+			int chunkBegin = JobBegin + (NextChunk++) * JobChunk;
+			if (chunkBegin >= JobEnd) break;
+			Job(chunkBegin, std::min(chunkBegin + JobChunk, JobEnd));
+		}
+	}
+
+	// seenGeneration is the last job before the worker started, which it must not run
+	void workerLoop(int index, unsigned int seenGeneration)
+	{
+		tracer.setThreadName("worker " + std::to_string(index));
+		insideWorker() = true;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(Mutex);
+				WakeUp.wait(lock, [&] { return Stop || JobGeneration != seenGeneration; });
+				if (Stop) return;
+				seenGeneration = JobGeneration;
+			}
+			runChunks();
+			{
+				std::lock_guard<std::mutex> lock(Mutex);
+				ActiveWorkers--;
+			}
+			Finished.notify_one();
+		}
+	}
+};
+ThreadPool threadPool;
@@ -0,0 +1,139 @@
+#pragma once
+#include <map>
+#include <string>
+#include <thread>
+#include <string.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware counters of the calling thread through Linux perf_event_open, elsewhere nothing is available.
+// Every counter is opened on its own instead of as a group, so a counter the CPU or the virtual machine
+// doesn't have (ENOENT) or perf_event_paranoid forbids only leaves its own column empty.
+enum PerfCounterEnum
+{
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,    // L1 data cache read misses
+	PERF_LLC_MISSES,    // last level cache misses
+	PERF_BRANCH_MISSES,
+	PERF_PAGE_FAULTS,   // software counters, there even without a PMU
+	PERF_TASK_CLOCK,    // ns the thread ran
+	PERF_COUNTER_NUMBER
+};
+
+class PerfCounters
+{
+public:
+	~PerfCounters() { close(); }
+
+	// returns false if no counter could be opened
+	bool open()
+	{
+		close();
+		bool any = false;
+#ifdef __linux__
+		const unsigned int TYPE[PERF_COUNTER_NUMBER] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+			PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE };
+		const unsigned long long CONFIG[PERF_COUNTER_NUMBER] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+			PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_PAGE_FAULTS, PERF_COUNT_SW_TASK_CLOCK };
+		for (int c = 0; c < PERF_COUNTER_NUMBER; c++)
+		{
+			perf_event_attr attribute;
+			memset(&attribute, 0, sizeof(attribute));
+			attribute.size = sizeof(attribute);
+			attribute.type = TYPE[c];
+			attribute.config = CONFIG[c];
+			attribute.exclude_kernel = 1;
+			attribute.exclude_hv = 1;
+			// more counters than the PMU has are multiplexed, the enabled and running times scale them back
+			attribute.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			Descriptors[c] = (int)syscall(__NR_perf_event_open, &attribute, 0, -1, -1, 0);
+			any = any || Descriptors[c] >= 0;
+		}
+#endif
+		return any;
+	}
+
+	void close()
+	{
+#ifdef __linux__
+		for (int c = 0; c < PERF_COUNTER_NUMBER; c++)
+			if (Descriptors[c] >= 0) ::close(Descriptors[c]);
+#endif
+		for (int c = 0; c < PERF_COUNTER_NUMBER; c++) Descriptors[c] = -1;
+	}
+
+	bool isAvailable(int counter) { return Descriptors[counter] >= 0; }
+
+	// current count of every counter since open, -1 if it isn't available
+	void read(long long value[PERF_COUNTER_NUMBER])
+	{
+		for (int c = 0; c < PERF_COUNTER_NUMBER; c++)
+		{
+			value[c] = -1;
+#ifdef __linux__
+			unsigned long long data[3]; // value, time enabled, time running
+			if (Descriptors[c] < 0 || ::read(Descriptors[c], data, sizeof(data)) != sizeof(data)) continue;
+			value[c] = data[2] == 0 ? 0 : (long long)((double)data[0] * data[1] / data[2]);
+#endif
+		}
+	}
+
+	static const char* getName(int counter)
+	{
+		const char* NAME[PERF_COUNTER_NUMBER] = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses", "page faults", "task clock" };
+		return NAME[counter];
+	}
+
+private:
+	int Descriptors[PERF_COUNTER_NUMBER] = { -1, -1, -1, -1, -1, -1, -1 };
+};
+
+// Counters summed per phase, a phase is every TRACE_SCOPE (see trace.h) on the thread that called start.
+// Nested phases are inclusive: "sweep constraints" is also part of "Cloth::Step". Worker threads aren't
+// counted, so the counter benchmark runs on the calling thread alone by default (--threads, see main.cpp).
+class PerfPhaseCounter
+{
+public:
+	struct Phase
+	{
+		long long Calls = 0;
+		long long Value[PERF_COUNTER_NUMBER] = { 0 }; // -1 once any read of the counter failed, 0 before the first call
+	};
+
+	bool Enabled = false;
+	PerfCounters Counters;
+	std::map<std::string, Phase> Phases;
+
+	bool start()
+	{
+		Phases.clear();
+		Owner = std::this_thread::get_id();
+		Enabled = Counters.open();
+		return Enabled;
+	}
+
+	void stop()
+	{
+		Enabled = false;
+		Counters.close();
+	}
+
+	bool isCounted() { return Enabled && std::this_thread::get_id() == Owner; }
+
+	void add(const char* name, const long long begin[PERF_COUNTER_NUMBER], const long long end[PERF_COUNTER_NUMBER])
+	{
+		Phase& phase = Phases[name];
+		phase.Calls++;
+		for (int c = 0; c < PERF_COUNTER_NUMBER; c++)
+			phase.Value[c] = (phase.Value[c] < 0 || begin[c] < 0 || end[c] < 0) ? -1 : phase.Value[c] + end[c] - begin[c];
+	}
+
+private:
+	std::thread::id Owner;
+};
+PerfPhaseCounter perfPhases;
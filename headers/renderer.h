@@ -1,9 +1,12 @@
 #pragma once
 #include <iostream>
+#include <chrono>
 #include <stdio.h>
 #include "cloth.h"
+#include "parallel.h"
 #include "shader.h"
 #include "camera.h"
+#include "stats.h"
 
 // public domain image loader
 #define STB_IMAGE_IMPLEMENTATION
@@ -18,6 +21,8 @@ const std::string CLOTH_VERTEX_PATH = "shaders/cloth.vs";
 const std::string CLOTH_FRAGMENT_PATH = "shaders/cloth.fs";
 const std::string TEXT_VERTEX_PATH = "shaders/text.vs";
 const std::string TEXT_FRAGMENT_PATH = "shaders/text.fs";
+const std::string HUD_VERTEX_PATH = "shaders/hud.vs";
+const std::string HUD_FRAGMENT_PATH = "shaders/hud.fs";
 const std::string FONT_PATH = "fonts/arial.ttf";
 /** end of constant variable**/
 
@@ -31,124 +36,281 @@ public:
 };
 Light sun;
 
+// Renders any number of cloths with one shader program and one VAO.
+// Every node is one vertex and the faces are an element buffer, positions are uploaded in world space,
+// so all cloths share the same model matrix and every draw mode is issued as a single multi draw call.
 class ClothRenderer
 {
 private:
-	const unsigned int aPtrPosition = 0, aPtrTexture = 1, aPtrNormal = 2;
+	const unsigned int aPtrPosition = 0, aPtrTexture = 1, aPtrNormal = 2, aPtrGrid = 3, aPtrCloth = 4;
+	const int POSITION_TEXTURE_UNIT = 2, BOX_TEXTURE_UNIT = 3;
 
 public:
-	Cloth* ClothObject;
+	// Where the vertex normals come from, the value of the normalMode uniform of the cloth shaders.
+	// In the GPU modes only the positions are uploaded every frame and Cloth::getNormals is never called.
+	enum NormalModeEnum
+	{
+		NORMAL_CPU,        // Cloth::getNormals, uploaded as the third vertex buffer
+		NORMAL_GPU_SMOOTH, // gathered in the vertex shader from the neighbour positions, read through a texture buffer
+		NORMAL_GPU_FLAT    // per face in the fragment shader from the screen space derivatives of the position
+	};
+	NormalModeEnum NormalMode = NORMAL_CPU;
+	// Compact vertex stream: positions as 3 x 16 bit normalized offsets in the bounding box of their cloth and
+	// normals octahedron encoded into 2 x 16 bit, 10 instead of 24 bytes per vertex and frame, decoded in cloth.vs
+	bool CompactVertices = false;
+
+	std::vector<Cloth*> ClothObjects;
 	int NodeCount;
+	std::vector<GLint> ClothFirst;   // first vertex of each cloth in the shared buffers
+	std::vector<GLsizei> ClothNodes; // vertex (node) number of each cloth
+	std::vector<GLsizei> ClothCount; // index number of each cloth, 3 per face
+	std::vector<size_t> ClothFirstIndex; // byte offset of the first index of each cloth in the element buffer
+
+	glm::vec3* VertexBufferObjectsPosition = nullptr;
+	glm::vec2* VertexBufferObjectsTexture = nullptr;
+	// normals are uploaded straight from Cloth::Normals
+	std::vector<GLushort> VertexBufferObjectsPositionCompact; // 3 per vertex
+	std::vector<GLshort> VertexBufferObjectsNormalCompact;    // 2 per vertex
+	std::vector<glm::vec4> ClothBox; // minimum and size of the bounding box of each cloth, for the compact stream
 
-	glm::vec3* VertexBufferObjectsPosition;
-	glm::vec2* VertexBufferObjectsTexture;
-	glm::vec3* VertexBufferObjectsNormal;
+	RenderStats Stats;
 
 	unsigned int ShaderProgramID;
 	unsigned int VertexArrayObjectsID; // VAO
-	unsigned int VertexBufferObjectsIDs[3]; // VBO
+	unsigned int VertexBufferObjectsIDs[5]; // VBO: position, texture, normal, grid coordinate, cloth index
+	unsigned int ElementBufferObjectsID; // EBO
+	unsigned int PositionTextureID; // texture buffer over the position VBO, for NORMAL_GPU_SMOOTH
+	unsigned int BoxBufferID, BoxTextureID; // ClothBox as a texture buffer
 	int Texture1, Texture2;
 
 	ClothRenderer() {}
-	void init(Cloth* cloth)
+	~ClothRenderer()
+	{
+		delete[] VertexBufferObjectsPosition;
+		delete[] VertexBufferObjectsTexture;
+	}
+
+	void init(Cloth* cloth) { init(std::vector<Cloth*>{ cloth }); }
+	void init(const std::vector<Cloth*>& cloths)
 	{
-		NodeCount = (int)(cloth->Faces.size());
-		if (NodeCount <= 0) 
+		ClothObjects = cloths;
+
+		// Build render program
+		Shader clothShader(CLOTH_VERTEX_PATH.c_str(), CLOTH_FRAGMENT_PATH.c_str());
+		ShaderProgramID = clothShader.ID;
+		// std::cout << "Cloth Shader Program ID: " << ShaderProgramID << std::endl;
+
+		glGenVertexArrays(1, &VertexArrayObjectsID);
+		glGenBuffers(5, VertexBufferObjectsIDs);
+		glGenBuffers(1, &ElementBufferObjectsID);
+		glGenTextures(1, &PositionTextureID);
+		glGenBuffers(1, &BoxBufferID);
+		glGenTextures(1, &BoxTextureID);
+		allocateBuffers();
+
+		Texture1 = loadTexture(TEXTURE_PATH);
+		// Texture2 = loadTexture(TEXTURE2_PATH); // you can set another texture to mix it if necessary
+
+		// activate/use the shader before setting uniforms
+		clothShader.use();
+		clothShader.setInt("Texture1", 0);
+		clothShader.setInt("Texture2", 1);
+		clothShader.setInt("positions", POSITION_TEXTURE_UNIT);
+		clothShader.setInt("boxes", BOX_TEXTURE_UNIT);
+
+		// Model Matrix : positions are already in world space, so it is always identity.
+		clothShader.setMat4("model", glm::mat4(1.0f));
+
+		// Light
+		clothShader.setVec3("lightPosition", sun.Position);
+		clothShader.setVec3("lightColor", sun.Color);
+		glUseProgram(0);
+	}
+
+	// (Re)build the shared buffers, called again when the node number of the cloths changes
+	void allocateBuffers()
+	{
+		ClothFirst.clear();
+		ClothNodes.clear();
+		ClothCount.clear();
+		ClothFirstIndex.clear();
+		NodeCount = 0;
+		std::vector<GLuint> indices;
+		for (Cloth* cloth : ClothObjects)
+		{
+			ClothFirst.push_back(NodeCount);
+			ClothNodes.push_back((GLsizei)cloth->Nodes.size());
+			ClothCount.push_back((GLsizei)cloth->FaceIndices.size());
+			ClothFirstIndex.push_back(indices.size() * sizeof(GLuint));
+			indices.insert(indices.end(), cloth->FaceIndices.begin(), cloth->FaceIndices.end());
+			NodeCount += (int)cloth->Nodes.size();
+		}
+		if (NodeCount <= 0)
 		{
 			std::cout << "ERROR::ClothRender : No node exists." << std::endl;
 			exit(-1);
 		}
-		this->ClothObject = cloth;
 
+		delete[] VertexBufferObjectsPosition;
+		delete[] VertexBufferObjectsTexture;
 		VertexBufferObjectsPosition = new glm::vec3[NodeCount];
 		VertexBufferObjectsTexture = new glm::vec2[NodeCount];
-		VertexBufferObjectsNormal = new glm::vec3[NodeCount];
-
-		for (int i = 0; i < NodeCount; i++) {
-			Node* n = cloth->Faces[i];
-			VertexBufferObjectsPosition[i] = glm::vec3(n->Position.x, n->Position.y, n->Position.z);
-			VertexBufferObjectsTexture[i] = glm::vec2(n->TextureCoord.x, n->TextureCoord.y); // Texture coord will only be set here
-			VertexBufferObjectsNormal[i] = glm::vec3(n->Normal.x, n->Normal.y, n->Normal.z);
+		VertexBufferObjectsPositionCompact.resize(CompactVertices ? 3 * NodeCount : 0);
+		VertexBufferObjectsNormalCompact.resize(CompactVertices ? 2 * NodeCount : 0);
+		ClothBox.resize(2 * ClothObjects.size());
+		GLint maxTexels = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+		PositionTextureFits = 3 * (GLint64)NodeCount <= maxTexels;
+		if (!PositionTextureFits && NormalMode == NORMAL_GPU_SMOOTH)
+		{
+			std::cout << "ClothRender : " << NodeCount << " nodes exceed the texture buffer size, normals fall back to the CPU." << std::endl;
+			NormalMode = NORMAL_CPU;
 		}
-
-		// Build render program
-		Shader clothShader(CLOTH_VERTEX_PATH.c_str(), CLOTH_FRAGMENT_PATH.c_str());
-		ShaderProgramID = clothShader.ID;
-		// std::cout << "Cloth Shader Program ID: " << ShaderProgramID << std::endl;
+		fillVertices(true);
 
 		/** binding and setting VAO and VBO **/
 		// 1. Bind VAO
 		// 2. Copy our vertices array in a buffer for OpenGL to use
 		// 3. Set the vertex attributes pointers
-		glGenVertexArrays(1, &VertexArrayObjectsID);
-		glGenBuffers(3, VertexBufferObjectsIDs);
 		glBindVertexArray(VertexArrayObjectsID);
 
 		glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObjectsIDs[0]);
-		glBufferData(GL_ARRAY_BUFFER, NodeCount * sizeof(glm::vec3), VertexBufferObjectsPosition, GL_DYNAMIC_DRAW);
-		glVertexAttribPointer(aPtrPosition, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		if (CompactVertices)
+		{
+			glBufferData(GL_ARRAY_BUFFER, NodeCount * 3 * sizeof(GLushort), VertexBufferObjectsPositionCompact.data(), GL_DYNAMIC_DRAW);
+			glVertexAttribPointer(aPtrPosition, 3, GL_UNSIGNED_SHORT, GL_TRUE, 0, (void*)0);
+		}
+		else
+		{
+			glBufferData(GL_ARRAY_BUFFER, NodeCount * sizeof(glm::vec3), VertexBufferObjectsPosition, GL_DYNAMIC_DRAW);
+			glVertexAttribPointer(aPtrPosition, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		}
 
+		// Texture coords never change, so they are uploaded only here
 		glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObjectsIDs[1]);
-		glBufferData(GL_ARRAY_BUFFER, NodeCount * sizeof(glm::vec2), VertexBufferObjectsTexture, GL_DYNAMIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, NodeCount * sizeof(glm::vec2), VertexBufferObjectsTexture, GL_STATIC_DRAW);
 		glVertexAttribPointer(aPtrTexture, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
 
 		glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObjectsIDs[2]);
-		glBufferData(GL_ARRAY_BUFFER, NodeCount * sizeof(glm::vec3), VertexBufferObjectsNormal, GL_DYNAMIC_DRAW);
-		glVertexAttribPointer(aPtrNormal, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		glBufferData(GL_ARRAY_BUFFER, NodeCount * (CompactVertices ? 2 * sizeof(GLshort) : sizeof(glm::vec3)), NULL, GL_DYNAMIC_DRAW);
+		if (NormalMode == NORMAL_CPU) uploadNormals();
+		if (CompactVertices) glVertexAttribPointer(aPtrNormal, 2, GL_SHORT, GL_TRUE, 0, (void*)0);
+		else glVertexAttribPointer(aPtrNormal, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+		// Grid coordinate (w, h, NodesInWidth, NodesInHeight) of every vertex, the shader finds the neighbours with it
+		std::vector<GLushort> grid;
+		grid.reserve(4 * NodeCount);
+		for (Cloth* cloth : ClothObjects)
+			for (int h = 0; h < cloth->NodesInHeight; h++)
+				for (int w = 0; w < cloth->NodesInWidth; w++)
+					grid.insert(grid.end(), { (GLushort)w, (GLushort)h, (GLushort)cloth->NodesInWidth, (GLushort)cloth->NodesInHeight });
+		glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObjectsIDs[3]);
+		glBufferData(GL_ARRAY_BUFFER, grid.size() * sizeof(GLushort), grid.data(), GL_STATIC_DRAW);
+		glVertexAttribIPointer(aPtrGrid, 4, GL_UNSIGNED_SHORT, 0, (void*)0);
+
+		// Cloth index of every vertex, selects the bounding box of the compact positions
+		std::vector<GLushort> clothIndex;
+		clothIndex.reserve(NodeCount);
+		for (int c = 0; c < ClothObjects.size(); c++) clothIndex.insert(clothIndex.end(), ClothNodes[c], (GLushort)c);
+		glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObjectsIDs[4]);
+		glBufferData(GL_ARRAY_BUFFER, clothIndex.size() * sizeof(GLushort), clothIndex.data(), GL_STATIC_DRAW);
+		glVertexAttribIPointer(aPtrCloth, 1, GL_UNSIGNED_SHORT, 0, (void*)0);
+
+		// The shader reads the positions of the neighbours as single components, RGB32F buffer textures need GL 4.0
+		glBindTexture(GL_TEXTURE_BUFFER, PositionTextureID);
+		glTexBuffer(GL_TEXTURE_BUFFER, CompactVertices ? GL_R16 : GL_R32F, VertexBufferObjectsIDs[0]);
+		glBindBuffer(GL_TEXTURE_BUFFER, BoxBufferID);
+		glBufferData(GL_TEXTURE_BUFFER, ClothBox.size() * sizeof(glm::vec4), ClothBox.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_BUFFER, BoxTextureID);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, BoxBufferID);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+		// The faces never change either, the element buffer is part of the VAO state
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ElementBufferObjectsID);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
 
 		glEnableVertexAttribArray(aPtrPosition);
 		glEnableVertexAttribArray(aPtrTexture);
-		glEnableVertexAttribArray(aPtrNormal);
+		if (NormalMode == NORMAL_CPU) glEnableVertexAttribArray(aPtrNormal);
+		else glDisableVertexAttribArray(aPtrNormal);
+		glEnableVertexAttribArray(aPtrGrid);
+		glEnableVertexAttribArray(aPtrCloth);
 		/** end of binding and setting VAO and VBO **/
 
-		Texture1 = loadTexture(TEXTURE_PATH);
-		// Texture2 = loadTexture(TEXTURE2_PATH); // you can set another texture to mix it if necessary
-
-		// activate/use the shader before setting uniforms
-		clothShader.use();
-		clothShader.setInt("Texture1", 0);
-		clothShader.setInt("Texture2", 1);
-
-		// Model Matrix : Put cloth into the world
-		// Model matrix won't change, so we set it here.
-		glm::mat4 modelMatrix = glm::mat4(1.0f);
-		modelMatrix = glm::translate(modelMatrix, glm::vec3(cloth->ClothPosition.x, cloth->ClothPosition.y, cloth->ClothPosition.z));
-		clothShader.setMat4("model", modelMatrix);
-
-		// Light
-		clothShader.setVec3("lightPosition", sun.Position);
-		clothShader.setVec3("lightColor", sun.Color);
-
 		// Clean
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glBindVertexArray(0);
 	}
 
+	// Switch the normal source, the normal buffer is only uploaded (and its attribute enabled) in NORMAL_CPU
+	void setNormalMode(NormalModeEnum mode)
+	{
+		if (mode == NORMAL_GPU_SMOOTH && !PositionTextureFits) mode = NORMAL_CPU;
+		NormalMode = mode;
+		glBindVertexArray(VertexArrayObjectsID);
+		if (NormalMode == NORMAL_CPU) glEnableVertexAttribArray(aPtrNormal);
+		else glDisableVertexAttribArray(aPtrNormal);
+		glBindVertexArray(0);
+	}
+
+	// Switch between the float and the compact vertex stream, the buffers are rebuilt in the new format
+	void setCompactVertices(bool compact)
+	{
+		CompactVertices = compact;
+		allocateBuffers();
+	}
+
 	void render()
 	{
-		// Update all the positions of nodes
-		for (int i = 0; i < NodeCount; i++) { // Tex coordinate dose not change
-			Node* n = ClothObject->Faces[i];
-			VertexBufferObjectsPosition[i] = glm::vec3(n->Position.x, n->Position.y, n->Position.z);
-			VertexBufferObjectsNormal[i] = glm::vec3(n->Normal.x, n->Normal.y, n->Normal.z);
+		// Rebuild buffers if any cloth has changed its node or face number
+		for (int c = 0; c < ClothObjects.size(); c++)
+		{
+			if (ClothNodes[c] != (GLsizei)ClothObjects[c]->Nodes.size() || ClothCount[c] != (GLsizei)ClothObjects[c]->FaceIndices.size())
+			{
+				allocateBuffers();
+				break;
+			}
 		}
+		// computed here if the cloths moved, so the cloths are done in parallel
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		if (NormalMode == NORMAL_CPU)
+			threadPool.ParallelFor(0, (int)ClothObjects.size(), [&](int c) { ClothObjects[c]->getNormals(); }, 1);
+		std::chrono::steady_clock::time_point normalEnd = std::chrono::steady_clock::now();
+
+		// Update all the positions of nodes
+		fillVertices(false);
 
 		glUseProgram(ShaderProgramID);
 
 		glBindVertexArray(VertexArrayObjectsID);
 
 		glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObjectsIDs[0]);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, NodeCount * sizeof(glm::vec3), VertexBufferObjectsPosition);
-		glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObjectsIDs[1]);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, NodeCount * sizeof(glm::vec2), VertexBufferObjectsTexture);
-		glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObjectsIDs[2]);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, NodeCount * sizeof(glm::vec3), VertexBufferObjectsNormal);
+		if (CompactVertices)
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, 0, NodeCount * 3 * sizeof(GLushort), VertexBufferObjectsPositionCompact.data());
+			glBindBuffer(GL_TEXTURE_BUFFER, BoxBufferID);
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, ClothBox.size() * sizeof(glm::vec4), ClothBox.data());
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		}
+		else glBufferSubData(GL_ARRAY_BUFFER, 0, NodeCount * sizeof(glm::vec3), VertexBufferObjectsPosition);
+		if (NormalMode == NORMAL_CPU)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObjectsIDs[2]);
+			uploadNormals();
+		}
+		std::chrono::steady_clock::time_point uploadEnd = std::chrono::steady_clock::now();
 
 		// binding texture 
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, Texture1);
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, Texture2);
+		glActiveTexture(GL_TEXTURE0 + POSITION_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, PositionTextureID);
+		glActiveTexture(GL_TEXTURE0 + BOX_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, BoxTextureID);
+		glActiveTexture(GL_TEXTURE0);
 
 		// projection matrix
 		glUniformMatrix4fv(glGetUniformLocation(ShaderProgramID, "projection"), 1, GL_FALSE, &camera.GetProjectionMatrix()[0][0]);
@@ -158,41 +320,150 @@ public:
 
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-		// setting drawmode
-		switch (ClothObject->drawMode)
-		{
-		case Cloth::DRAW_NODES:
-			glDrawArrays(GL_POINTS, 0, NodeCount);
-			break;
-		case Cloth::DRAW_LINES:
-			glDrawArrays(GL_LINES, 0, NodeCount);
-			break;
-		default:
-			glDrawArrays(GL_TRIANGLES, 0, NodeCount);
-			break;
-		}
+		// setting drawmode, cloths with the same draw mode are drawn together
+		// points and lines have no face, they use the smooth normals in NORMAL_GPU_FLAT
+		glUniform1i(glGetUniformLocation(ShaderProgramID, "compactVertices"), CompactVertices);
+		GLint normalModeLocation = glGetUniformLocation(ShaderProgramID, "normalMode");
+		glUniform1i(normalModeLocation, NormalMode == NORMAL_GPU_FLAT ? NORMAL_GPU_SMOOTH : NormalMode);
+		drawBatch(Cloth::DRAW_NODES, GL_POINTS);
+		drawBatch(Cloth::DRAW_LINES, GL_LINES);
+		glUniform1i(normalModeLocation, NormalMode);
+		drawBatch(Cloth::DRAW_FACES, GL_TRIANGLES);
 
 		// End of rendering
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glBindVertexArray(0);
 		glUseProgram(0);
+
+		std::chrono::steady_clock::time_point drawEnd = std::chrono::steady_clock::now();
+		Stats.NormalTime = std::chrono::duration<double, std::milli>(normalEnd - begin).count();
+		Stats.UploadTime = std::chrono::duration<double, std::milli>(uploadEnd - normalEnd).count();
+		Stats.DrawTime = std::chrono::duration<double, std::milli>(drawEnd - uploadEnd).count();
+		if (tracer.Enabled)
+		{
+			tracer.record("normals", begin, normalEnd);
+			tracer.record("upload", normalEnd, uploadEnd);
+			tracer.record("draw", uploadEnd, drawEnd);
+		}
+	}
+
+private:
+	bool PositionTextureFits = true; // 3 floats per node fit in GL_MAX_TEXTURE_BUFFER_SIZE
+
+	// nodes in grid order h * NodesInWidth + w, the order of Cloth::FaceIndices and Cloth::Normals
+	void fillVertices(bool withTexture)
+	{
+		threadPool.ParallelFor(0, (int)ClothObjects.size(), [&](int c)
+		{
+			Cloth* cloth = ClothObjects[c];
+			glm::vec3* position = VertexBufferObjectsPosition + ClothFirst[c];
+			for (int h = 0; h < cloth->NodesInHeight; h++)
+				for (int w = 0; w < cloth->NodesInWidth; w++)
+					position[h * cloth->NodesInWidth + w] = glm::vec3(cloth->getWorldPos(cloth->getNode(w, h)));
+			if (CompactVertices) fillCompact(c);
+			if (withTexture)
+			{
+				glm::vec2* texture = VertexBufferObjectsTexture + ClothFirst[c];
+				for (int h = 0; h < cloth->NodesInHeight; h++)
+					for (int w = 0; w < cloth->NodesInWidth; w++)
+						texture[h * cloth->NodesInWidth + w] = cloth->getNode(w, h)->TextureCoord;
+			}
+		}, 1);
+	}
+
+	// Quantize the float positions of cloth c into its bounding box, encode its normals
+	void fillCompact(int c)
+	{
+		glm::vec3* position = VertexBufferObjectsPosition + ClothFirst[c];
+		glm::vec3 low = position[0], high = position[0];
+		for (int i = 1; i < ClothNodes[c]; i++)
+		{
+			low = glm::min(low, position[i]);
+			high = glm::max(high, position[i]);
+		}
+		glm::vec3 size = glm::max(high - low, glm::vec3(1e-6f));
+		ClothBox[2 * c] = glm::vec4(low, 0.0f);
+		ClothBox[2 * c + 1] = glm::vec4(size, 0.0f);
+		glm::vec3 scale = 65535.0f / size;
+		GLushort* compact = &VertexBufferObjectsPositionCompact[3 * ClothFirst[c]];
+		for (int i = 0; i < ClothNodes[c]; i++)
+		{
+			glm::vec3 q = (position[i] - low) * scale + glm::vec3(0.5f);
+			for (int k = 0; k < 3; k++) compact[3 * i + k] = (GLushort)glm::clamp(q[k], 0.0f, 65535.0f);
+		}
+		if (NormalMode != NORMAL_CPU) return;
+		std::vector<glm::vec3>& normals = ClothObjects[c]->getNormals();
+		GLshort* normal = &VertexBufferObjectsNormalCompact[2 * ClothFirst[c]];
+		for (int i = 0; i < ClothNodes[c]; i++)
+		{
+			glm::vec2 e = encodeOctahedron(normals[i]);
+			normal[2 * i] = (GLshort)std::lround(e.x * 32767.0f);
+			normal[2 * i + 1] = (GLshort)std::lround(e.y * 32767.0f);
+		}
+	}
+
+	// Unit vector to the octahedron folded onto [-1, 1]^2, decoded by decodeOctahedron in cloth.vs
+	static glm::vec2 encodeOctahedron(glm::vec3 n)
+	{
+		n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		if (!(n.z < 0.0f)) return glm::vec2(n.x, n.y);
+		return glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+	}
+
+	// into the bound normal buffer
+	void uploadNormals()
+	{
+		if (CompactVertices)
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, 0, NodeCount * 2 * sizeof(GLshort), VertexBufferObjectsNormalCompact.data());
+			return;
+		}
+		for (int c = 0; c < ClothObjects.size(); c++)
+			glBufferSubData(GL_ARRAY_BUFFER, ClothFirst[c] * sizeof(glm::vec3), ClothNodes[c] * sizeof(glm::vec3), ClothObjects[c]->getNormals().data());
+	}
+
+	void drawBatch(Cloth::DrawModeEnum drawMode, GLenum primitive)
+	{
+		std::vector<GLsizei> count;
+		std::vector<const void*> indices;
+		std::vector<GLint> baseVertex;
+		for (int c = 0; c < ClothObjects.size(); c++)
+		{
+			if (ClothObjects[c]->drawMode != drawMode) continue;
+			count.push_back(ClothCount[c]);
+			indices.push_back((const void*)ClothFirstIndex[c]);
+			baseVertex.push_back(ClothFirst[c]);
+		}
+		if (!count.empty())
+			glMultiDrawElementsBaseVertex(primitive, count.data(), GL_UNSIGNED_INT, indices.data(), (GLsizei)count.size(), baseVertex.data());
 	}
 };
 
 struct Character
 {
-	unsigned int TextureID;  // ID handle of the glyph texture
+	glm::vec2    AtlasMin;   // texture coordinates of the glyph in the atlas
+	glm::vec2    AtlasMax;
 	glm::ivec2   Size;       // Size of glyph
 	glm::ivec2   Bearing;    // Offset from baseline to left/top of glyph
 	unsigned int Advance;    // Offset to advance to next glyph
 };
 
+// Draws text from one glyph atlas texture. AddText only appends the quads of a string to the batch,
+// Flush uploads the whole batch at once and draws it with one call, so a complete overlay costs one upload and one draw.
 class TextRenderer
 {
 public: 
-	std::map<GLchar, Character> Characters; 
+	struct TextVertex
+	{
+		glm::vec4 PositionTexture; // <vec2 pos, vec2 tex>
+		glm::vec3 Color;
+	};
+
+	Character Characters[128];
 	Shader shader;
 	unsigned int VAO, VBO;
+	unsigned int AtlasTextureID;
+	std::vector<TextVertex> Batch;
 	TextRenderer(){};
 	void init(int fontSize)
 	{
@@ -200,6 +471,7 @@ public:
 		glm::mat4 projection = glm::ortho(0.0f, static_cast<float>(WIDTH), 0.0f, static_cast<float>(HEIGHT));
 		shader.use();
 		glUniformMatrix4fv(glGetUniformLocation(shader.ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+		shader.setInt("text", 0);
 
 		FT_Library FreeType;
 		if (FT_Init_FreeType(&FreeType))
@@ -219,106 +491,134 @@ public:
 		// Setting the width to 0 lets the face dynamically calculate the width based on the given height.
 		FT_Set_Pixel_Sizes(FTface, 0, fontSize);
 
-		// disable byte-alignment restriction
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
+		/** glyph atlas **/
+		// Glyphs are placed on shelves (rows) of ATLAS_WIDTH pixels, with a 1 pixel gap so the linear filter never
+		// reads the neighbour glyph, and the atlas is uploaded as one texture once all of them are placed.
+		const int ATLAS_WIDTH = 512, GAP = 1;
+		std::vector<std::vector<unsigned char>> bitmaps(128);
+		std::vector<glm::ivec2> offsets(128);
+		int x = GAP, y = GAP, shelfHeight = 0;
 		for (unsigned char c = 0; c < 128; c++)
 		{
 			// load character glyph 
 			if (FT_Load_Char(FTface, c, FT_LOAD_RENDER))
 			{
 				std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
+				Characters[c] = Character();
 				continue;
 			}
-			// generate texture
-			unsigned int texture;
-			glGenTextures(1, &texture);
-			glBindTexture(GL_TEXTURE_2D, texture);
-			glTexImage2D(
-				GL_TEXTURE_2D,
-				0,
-				GL_RED,
-				FTface->glyph->bitmap.width,
-				FTface->glyph->bitmap.rows,
-				0,
-				GL_RED,
-				GL_UNSIGNED_BYTE,
-				FTface->glyph->bitmap.buffer
-			);
-			// set texture options
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			// now store character for later use
-			Character character = {
-				texture,
-				glm::ivec2(FTface->glyph->bitmap.width, FTface->glyph->bitmap.rows),
+			FT_Bitmap& bitmap = FTface->glyph->bitmap;
+			int width = (int)bitmap.width, rows = (int)bitmap.rows;
+			if (x + width + GAP > ATLAS_WIDTH)
+			{
+				x = GAP;
+				y += shelfHeight + GAP;
+				shelfHeight = 0;
+			}
+			offsets[c] = glm::ivec2(x, y);
+			bitmaps[c].resize(width * rows);
+			for (int row = 0; row < rows; row++)
+				std::copy(bitmap.buffer + row * bitmap.pitch, bitmap.buffer + row * bitmap.pitch + width, bitmaps[c].begin() + row * width);
+			// texture coordinates are filled once the atlas height is known
+			Characters[c] = {
+				glm::vec2(0.0f), glm::vec2(0.0f),
+				glm::ivec2(width, rows),
 				glm::ivec2(FTface->glyph->bitmap_left, FTface->glyph->bitmap_top),
 				static_cast<unsigned int>(FTface->glyph->advance.x)
 			};
-			Characters.insert(std::pair<char, Character>(c, character));
+			x += width + GAP;
+			shelfHeight = std::max(shelfHeight, rows);
 		}
+		int atlasHeight = y + shelfHeight + GAP;
+		std::vector<unsigned char> atlas(ATLAS_WIDTH * atlasHeight, 0);
+		for (int c = 0; c < 128; c++)
+		{
+			Character& ch = Characters[c];
+			for (int row = 0; row < ch.Size.y; row++)
+				std::copy(bitmaps[c].begin() + row * ch.Size.x, bitmaps[c].begin() + (row + 1) * ch.Size.x, atlas.begin() + (offsets[c].y + row) * ATLAS_WIDTH + offsets[c].x);
+			ch.AtlasMin = glm::vec2((float)offsets[c].x / ATLAS_WIDTH, (float)offsets[c].y / atlasHeight);
+			ch.AtlasMax = glm::vec2((float)(offsets[c].x + ch.Size.x) / ATLAS_WIDTH, (float)(offsets[c].y + ch.Size.y) / atlasHeight);
+		}
+
+		// disable byte-alignment restriction
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glGenTextures(1, &AtlasTextureID);
+		glBindTexture(GL_TEXTURE_2D, AtlasTextureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, ATLAS_WIDTH, atlasHeight, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.data());
+		// set texture options
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glBindTexture(GL_TEXTURE_2D, 0);
+		/** end of glyph atlas **/
 
 		FT_Done_Face(FTface);
 		FT_Done_FreeType(FreeType);
 
-		// configure VAO/VBO
+		// configure VAO/VBO, the buffer grows in Flush
 		glGenVertexArrays(1, &VAO);
 		glGenBuffers(1, &VBO);
 		glBindVertexArray(VAO);
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
 		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)offsetof(TextVertex, PositionTexture));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)offsetof(TextVertex, Color));
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glBindVertexArray(0);
 	}
 
-	void RenderText(std::string text, float x, float y, float scale, glm::vec3 color)
+	// Append the quads of text to the batch, drawn by the next Flush
+	void AddText(const std::string& text, float x, float y, float scale, glm::vec3 color)
 	{
-		// activate corresponding render state	
-		shader.use();
-		glUniform3f(glGetUniformLocation(shader.ID, "textColor"), color.x, color.y, color.z);
-		glActiveTexture(GL_TEXTURE0);
-		glBindVertexArray(VAO);
-
-		// iterate through all characters
-		std::string::const_iterator c;
-		for (c = text.begin(); c != text.end(); c++)
+		for (char c : text)
 		{
-			Character ch = Characters[*c];
+			if ((unsigned char)c >= 128) continue;
+			const Character& ch = Characters[(unsigned char)c];
 
 			float xpos = x + ch.Bearing.x * scale;
 			float ypos = y - (ch.Size.y - ch.Bearing.y) * scale;
 
 			float w = ch.Size.x * scale;
 			float h = ch.Size.y * scale;
-			// update VBO for each character
-			float vertices[6][4] = {
-				{ xpos,     ypos + h,   0.0f, 0.0f },
-				{ xpos,     ypos,       0.0f, 1.0f },
-				{ xpos + w, ypos,       1.0f, 1.0f },
-
-				{ xpos,     ypos + h,   0.0f, 0.0f },
-				{ xpos + w, ypos,       1.0f, 1.0f },
-				{ xpos + w, ypos + h,   1.0f, 0.0f }
-			};
-			// render glyph texture over quad
-			glBindTexture(GL_TEXTURE_2D, ch.TextureID);
-			// update content of VBO memory
-			glBindBuffer(GL_ARRAY_BUFFER, VBO);
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices); // be sure to use glBufferSubData and not glBufferData
-
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-			// render quad
-			glDrawArrays(GL_TRIANGLES, 0, 6);
+			glm::vec2 t0 = ch.AtlasMin, t1 = ch.AtlasMax;
+			Batch.insert(Batch.end(), {
+				{ glm::vec4(xpos,     ypos + h, t0.x, t0.y), color },
+				{ glm::vec4(xpos,     ypos,     t0.x, t1.y), color },
+				{ glm::vec4(xpos + w, ypos,     t1.x, t1.y), color },
+
+				{ glm::vec4(xpos,     ypos + h, t0.x, t0.y), color },
+				{ glm::vec4(xpos + w, ypos,     t1.x, t1.y), color },
+				{ glm::vec4(xpos + w, ypos + h, t1.x, t0.y), color }
+			});
 			// now advance cursors for next glyph (note that advance is number of 1/64 pixels)
 			x += (ch.Advance >> 6) * scale; // bitshift by 6 to get value in pixels (2^6 = 64 (divide amount of 1/64th pixels by 64 to get amount of pixels))
 		}
+	}
+
+	// Draw everything added since the last Flush with one upload and one draw call
+	void Flush()
+	{
+		if (Batch.empty()) return;
+		shader.use();
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, AtlasTextureID);
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		// a new store every time, so the driver never waits for the previous draw to read the old one
+		glBufferData(GL_ARRAY_BUFFER, Batch.size() * sizeof(TextVertex), Batch.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)Batch.size());
 		glBindVertexArray(0);
 		glBindTexture(GL_TEXTURE_2D, 0);
+		Batch.clear();
+	}
+
+	void RenderText(const std::string& text, float x, float y, float scale, glm::vec3 color)
+	{
+		AddText(text, x, y, scale, color);
+		Flush();
 	}
 };
 
@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "cloth.h"
+#include "parallel.h"
+#include "lod.h"
+
+// A scene owns several cloths, each cloth keeps its own MethodClass settings.
+// Cloths share no simulation state, so every cloth is stepped as an independent task.
+class Scene
+{
+public:
+	std::vector<Cloth*> Cloths;
+	std::vector<ClothLOD*> LODs; // one per cloth when level of detail is enabled, otherwise empty
+
+	Scene() {}
+	~Scene()
+	{
+		Destroy();
+	}
+
+	Cloth* Add(glm::vec3 position, glm::vec2 size, MethodClass method, ClothMaterial material = ClothMaterial())
+	{
+		Cloth* cloth = new Cloth(position, size, method, material);
+		Cloths.push_back(cloth);
+		if (!LODs.empty()) LODs.push_back(new ClothLOD(cloth));
+		return cloth;
+	}
+
+	void enableLOD(bool enable, int levelNumber = 3)
+	{
+		if (enable == !LODs.empty()) return;
+		if (enable)
+		{
+			for (Cloth* cloth : Cloths) LODs.push_back(new ClothLOD(cloth, levelNumber));
+			return;
+		}
+		// back to full resolution
+		for (ClothLOD* lod : LODs)
+		{
+			lod->setLevel(0);
+			delete lod;
+		}
+		LODs.clear();
+	}
+
+	void UpdateLOD(Camera& camera, int viewportHeight)
+	{
+		threadPool.ParallelFor(0, (int)LODs.size(), [&](int i) { LODs[i]->Update(camera, viewportHeight); }, 1);
+	}
+
+	void Step(GLdouble dt)
+	{
+		TRACE_SCOPE("Scene::Step");
+		threadPool.ParallelFor(0, (int)Cloths.size(), [&](int i) { Cloths[i]->Step(dt); }, 1);
+	}
+
+	void reset()
+	{
+		for (Cloth* cloth : Cloths) cloth->reset();
+	}
+
+	void UpdateVelocity(VelocityUpdate update, GLdouble force = -1.0)
+	{
+		for (Cloth* cloth : Cloths) cloth->UpdateVelocity(update, force);
+	}
+
+	void setDrawMode(Cloth::DrawModeEnum mode)
+	{
+		for (Cloth* cloth : Cloths) cloth->drawMode = mode;
+	}
+
+	int getNodeCount()
+	{
+		int count = 0;
+		for (Cloth* cloth : Cloths) count += (int)cloth->Nodes.size();
+		return count;
+	}
+
+	// convergence of the slowest cloth in the last frame: the most iterations and the largest residuals over all cloths
+	SolverStats getWorstStats()
+	{
+		SolverStats worst;
+		for (Cloth* cloth : Cloths)
+		{
+			worst.Iterations = std::max(worst.Iterations, cloth->Stats.Iterations);
+			worst.CoarseIterations = std::max(worst.CoarseIterations, cloth->Stats.CoarseIterations);
+			worst.MaxResidual = std::max(worst.MaxResidual, cloth->Stats.MaxResidual);
+			worst.RmsResidual = std::max(worst.RmsResidual, cloth->Stats.RmsResidual);
+		}
+		return worst;
+	}
+
+	void Destroy()
+	{
+		for (int i = 0; i < LODs.size(); i++) { delete LODs[i]; }
+		LODs.clear();
+		for (int i = 0; i < Cloths.size(); i++) { delete Cloths[i]; }
+		Cloths.clear();
+	}
+};
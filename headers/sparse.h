@@ -0,0 +1,216 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include "parallel.h"
+
+// Sparse matrix in block compressed sparse row format, one 3x3 block per pair of coupled nodes.
+// The structure is built once from the topology, only the block values change every step.
+class BlockCSRMatrix
+{
+public:
+	int Rows = 0;
+	std::vector<int> RowStart;           // first block of every row, Rows + 1 entries
+	std::vector<int> Columns;            // column of every block, sorted within a row
+	std::vector<glm::dmat3> Blocks;
+	std::vector<int> Diagonal;           // block index of (i, i)
+
+	// couplings are (i, j) pairs, both (i, j) and (j, i) are stored, diagonal blocks are always present
+	void Build(int rows, const std::vector<std::pair<int, int>>& couplings)
+	{
+		Rows = rows;
+		std::vector<std::vector<int>> rowColumns(rows);
+		for (int i = 0; i < rows; i++) rowColumns[i].push_back(i);
+		for (const std::pair<int, int>& c : couplings)
+		{
+			rowColumns[c.first].push_back(c.second);
+			rowColumns[c.second].push_back(c.first);
+		}
+		RowStart.assign(1, 0);
+		Columns.clear();
+		Diagonal.resize(rows);
+		for (int i = 0; i < rows; i++)
+		{
+			std::vector<int>& columns = rowColumns[i];
+			std::sort(columns.begin(), columns.end());
+			columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+			for (int column : columns)
+			{
+				if (column == i) Diagonal[i] = (int)Columns.size();
+				Columns.push_back(column);
+			}
+			RowStart.push_back((int)Columns.size());
+		}
+		Blocks.assign(Columns.size(), glm::dmat3(0.0));
+	}
+
+	// block index of (row, column), -1 if it is not in the structure
+	int find(int row, int column)
+	{
+		std::vector<int>::iterator begin = Columns.begin() + RowStart[row], end = Columns.begin() + RowStart[row + 1];
+		std::vector<int>::iterator it = std::lower_bound(begin, end, column);
+		return (it != end && *it == column) ? (int)(it - Columns.begin()) : -1;
+	}
+
+	void setZero() { std::fill(Blocks.begin(), Blocks.end(), glm::dmat3(0.0)); }
+
+	// y = A * x
+	void Multiply(const std::vector<glm::dvec3>& x, std::vector<glm::dvec3>& y)
+	{
+		y.resize(Rows);
+		threadPool.ParallelFor(0, Rows, [&](int i)
+		{
+			glm::dvec3 sum(0.0);
+			for (int k = RowStart[i]; k < RowStart[i + 1]; k++)
+				sum += Blocks[k] * x[Columns[k]];
+			y[i] = sum;
+		});
+	}
+};
+
+// Solve A x = b with conjugate gradient, preconditioned by the inverse diagonal blocks of A.
+// x is used as initial guess. Stops at maxIterations or once |r| <= tolerance * |b|.
+// Returns the iterations done, relativeResidual receives |r| / |b|.
+int SolvePCG(BlockCSRMatrix& A, const std::vector<glm::dvec3>& b, std::vector<glm::dvec3>& x,
+			 int maxIterations, double tolerance, double& relativeResidual)
+{
+	int n = A.Rows;
+	std::vector<glm::dmat3> preconditioner(n);
+	std::vector<glm::dvec3> r(n), z(n), p(n), q(n);
+	for (int i = 0; i < n; i++) preconditioner[i] = glm::inverse(A.Blocks[A.Diagonal[i]]);
+
+	A.Multiply(x, q);
+	double rz = 0.0, bNorm = 0.0, rNorm = 0.0;
+	for (int i = 0; i < n; i++)
+	{
+		r[i] = b[i] - q[i];
+		z[i] = preconditioner[i] * r[i];
+		p[i] = z[i];
+		rz += glm::dot(r[i], z[i]);
+		bNorm += glm::dot(b[i], b[i]);
+		rNorm += glm::dot(r[i], r[i]);
+	}
+	bNorm = std::sqrt(bNorm);
+	if (bNorm == 0.0) bNorm = 1.0;
+	relativeResidual = std::sqrt(rNorm) / bNorm;
+
+	int iteration = 0;
+	while (iteration < maxIterations && relativeResidual > tolerance)
+	{
+		A.Multiply(p, q);
+		double pq = 0.0;
+		for (int i = 0; i < n; i++) pq += glm::dot(p[i], q[i]);
+		if (pq <= 0.0) break; // not positive definite any more
+		double alpha = rz / pq, rzNew = 0.0;
+		rNorm = 0.0;
+		for (int i = 0; i < n; i++)
+		{
+			x[i] += alpha * p[i];
+			r[i] -= alpha * q[i];
+			z[i] = preconditioner[i] * r[i];
+			rzNew += glm::dot(r[i], z[i]);
+			rNorm += glm::dot(r[i], r[i]);
+		}
+		double beta = rzNew / rz;
+		rz = rzNew;
+		for (int i = 0; i < n; i++) p[i] = z[i] + beta * p[i];
+		relativeResidual = std::sqrt(rNorm) / bNorm;
+		iteration++;
+	}
+	return iteration;
+}
+
+// Cholesky factorization A = L L^T of a symmetric positive definite scalar matrix in skyline (envelope) storage.
+// Row i of L is stored from its first nonzero column First[i] to the diagonal; all fill-in of a Cholesky
+// factorization stays inside this envelope, so for a grid numbered row by row it costs O(n * bandwidth^2) once,
+// and each solve costs O(n * bandwidth). The same factor is applied to x, y and z at once.
+class SkylineCholesky
+{
+public:
+	int Rows = 0;
+	std::vector<int> First;          // first column of the envelope of every row
+	std::vector<size_t> RowStart;    // offset of L(i, First[i]) in Values
+	std::vector<double> Values;
+
+	// couplings are the (i, j) pairs with a nonzero A(i, j), the diagonal is always present
+	void Build(int rows, const std::vector<std::pair<int, int>>& couplings)
+	{
+		Rows = rows;
+		First.resize(rows);
+		for (int i = 0; i < rows; i++) First[i] = i;
+		for (const std::pair<int, int>& c : couplings)
+		{
+			int row = std::max(c.first, c.second), column = std::min(c.first, c.second);
+			First[row] = std::min(First[row], column);
+		}
+		RowStart.resize(rows + 1);
+		RowStart[0] = 0;
+		for (int i = 0; i < rows; i++) RowStart[i + 1] = RowStart[i] + (i - First[i] + 1);
+		Values.assign(RowStart[rows], 0.0);
+	}
+
+	// A(i, j) += value, only the lower triangle is stored so (i, j) and (j, i) are the same entry
+	void add(int i, int j, double value)
+	{
+		if (j > i) std::swap(i, j);
+		at(i, j) += value;
+	}
+
+	// Replace the assembled A by L, returns false if A is not positive definite
+	bool Factor()
+	{
+		for (int i = 0; i < Rows; i++)
+		{
+			for (int j = First[i]; j <= i; j++)
+			{
+				double sum = at(i, j);
+				for (int k = std::max(First[i], First[j]); k < j; k++) sum -= at(i, k) * at(j, k);
+				if (j < i) at(i, j) = sum / at(j, j);
+				else
+				{
+					if (sum <= 0.0) return false;
+					at(i, i) = std::sqrt(sum);
+				}
+			}
+		}
+		return true;
+	}
+
+	// Solve L L^T x = b in place
+	void Solve(std::vector<glm::dvec3>& b)
+	{
+		// plain scalar loops over the stored row, this is the hot loop of every global step
+		for (int i = 0; i < Rows; i++)
+		{
+			const double* row = &Values[RowStart[i]];
+			const glm::dvec3* column = &b[First[i]];
+			int length = i - First[i];
+			double x = b[i].x, y = b[i].y, z = b[i].z;
+			for (int k = 0; k < length; k++)
+			{
+				x -= row[k] * column[k].x;
+				y -= row[k] * column[k].y;
+				z -= row[k] * column[k].z;
+			}
+			b[i] = glm::dvec3(x, y, z) / row[length];
+		}
+		for (int i = Rows - 1; i >= 0; i--)
+		{
+			const double* row = &Values[RowStart[i]];
+			glm::dvec3* column = &b[First[i]];
+			int length = i - First[i];
+			b[i] /= row[length];
+			double x = b[i].x, y = b[i].y, z = b[i].z;
+			for (int k = 0; k < length; k++)
+			{
+				column[k].x -= row[k] * x;
+				column[k].y -= row[k] * y;
+				column[k].z -= row[k] * z;
+			}
+		}
+	}
+
+private:
+	double& at(int i, int j) { return Values[RowStart[i] + (j - First[i])]; }
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include "node.h"
 #include <stdio.h>
+#include <algorithm>
 
 // this header file is only used to simulate mass-spring system
 
@@ -28,10 +29,31 @@ public:
     void applyInternalForce(double timeStep) 
     {
         double currLength = glm::length(Node1->Position - Node2->Position);
+        if (currLength == 0.0) return; // no direction to pull along
         glm::vec<3, double> force1 = (Node2->Position - Node1->Position) / currLength;
         glm::vec<3, double> diffV1 = Node2->Velocity - Node1->Velocity;
         glm::vec<3, double> f1 = force1 * ((currLength - RestLength) * HookPara + glm::dot(diffV1, force1) * DampPara);
         Node1->addForce(f1);
         Node2->addForce(-f1);
     }
+
+    // Force derivatives for implicit integration: dfdx = d(force on Node1) / d(Node2->Position)
+    // and dfdv = d(force on Node1) / d(Node2->Velocity). The Node1 derivatives are their negatives.
+    // The transverse term is clamped for compressed springs so the system stays positive definite.
+    // A zero length spring has no direction and contributes nothing.
+    void computeJacobian(glm::dmat3& dfdx, glm::dmat3& dfdv)
+    {
+        glm::vec<3, double> direction = Node2->Position - Node1->Position;
+        double currLength = glm::length(direction);
+        if (currLength == 0.0)
+        {
+            dfdx = dfdv = glm::dmat3(0.0);
+            return;
+        }
+        direction /= currLength;
+        glm::dmat3 outer = glm::outerProduct(direction, direction);
+        double transverse = std::max(0.0, 1.0 - RestLength / currLength);
+        dfdx = HookPara * (outer + transverse * (glm::dmat3(1.0) - outer));
+        dfdv = DampPara * outer;
+    }
 };
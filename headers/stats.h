@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <glad/glad.h>
+
+// Convergence of the constraint solve of one cloth in the last frame.
+// Residuals are the relative constraint values |C_j(x)| / RestLength met during the sweeps, so no extra pass is needed.
+// They cover the distance constraints and the membrane warp and weft strains, not isometric bending.
+struct SolverStats
+{
+	int Iterations = 0;            // sweeps done in the frame (all small steps for XPBD_SS), varies with Tolerance
+	GLdouble CoarseIterations = 0.0; // coarse hierarchy levels, in sweeps over the cloth grid's constraints, not in Iterations
+	GLdouble MaxResidual = 0.0;    // of the last sweep
+	GLdouble RmsResidual = 0.0;    // of the last sweep
+	std::vector<GLdouble> ResidualHistory; // RMS residual of every sweep, only filled if the method tracks convergence
+
+	/** kept over frames, not cleared by reset **/
+	long long TotalIterations = 0;
+	GLdouble TotalCoarseIterations = 0.0;
+	int Frames = 0;
+
+	GLdouble getAverageIterations() { return Frames > 0 ? (GLdouble)TotalIterations / Frames : 0.0; }
+	GLdouble getAverageCoarseIterations() { return Frames > 0 ? TotalCoarseIterations / Frames : 0.0; }
+
+	// start a new frame
+	void reset()
+	{
+		Iterations = 0;
+		CoarseIterations = 0.0;
+		MaxResidual = 0.0;
+		RmsResidual = 0.0;
+		ResidualHistory.clear();
+		Frames++;
+	}
+};
+
+// CPU time in ms of the render phases of the last frame, measured by ClothRenderer::render.
+// Draw calls return before the GPU is done, so DrawTime is the time to issue them.
+struct RenderStats
+{
+	double NormalTime = 0.0; // Cloth::getNormals, 0 if the normals come from the GPU
+	double UploadTime = 0.0; // filling and uploading the vertex buffers
+	double DrawTime = 0.0;
+};
@@ -0,0 +1,128 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+#include "config.h"
+#include "parallel.h"
+
+// One cloth of one combination of the sweep values
+struct SweepRun
+{
+	int Combination;
+	std::vector<std::string> Values; // of every sweep key, as JSON text except for plain strings
+	int ClothIndex;                  // among all cloths of the scene, copies included
+	ClothConfig Cloth;
+	glm::vec3 Position;
+	double TimeStep;
+	int Frames;
+
+	/** results **/
+	double FrameTime = 0.0; // ms
+	double StretchError = 0.0;
+	double RmsResidual = 0.0, MaxResidual = 0.0;
+	double AverageIterations = 0.0;
+	double AverageCoarseIterations = 0.0; // hierarchy levels, in sweeps over the cloth grid
+	double KineticEnergy = 0.0, PotentialEnergy = 0.0;
+	/** end of results **/
+};
+
+// quoted if the text has a comma or a quote, e.g. the JSON of an array
+std::string csvField(const std::string& text)
+{
+	if (text.find_first_of(",\"") == std::string::npos) return text;
+	std::string quoted = "\"";
+	for (char c : text) quoted += c == '"' ? std::string("\"\"") : std::string(1, c);
+	return quoted + "\"";
+}
+
+// --sweep: every combination of the sweep values is applied to the scene like --set, and every cloth of every
+// combination is simulated for config.TotalFrame frames as a task of the thread pool. A run owns its cloth and a
+// cloth called from a worker runs its own parallel loops serially, so the runs share nothing. One CSV row per run
+// goes to config.Output. The frame time is measured while the other runs occupy the remaining cores.
+bool RunParameterSweep(SceneConfig& config)
+{
+	// "method" replaces every method setting, so it is applied before the other keys of a combination
+	std::vector<std::pair<std::string, std::vector<JsonValue>>> axes;
+	for (std::pair<std::string, std::vector<JsonValue>>& axis : config.Sweep) if (axis.first == "method") axes.push_back(axis);
+	for (std::pair<std::string, std::vector<JsonValue>>& axis : config.Sweep) if (axis.first != "method") axes.push_back(axis);
+
+	std::vector<SweepRun> runs;
+	std::vector<int> index(axes.size(), 0);
+	for (int combination = 0; ; combination++)
+	{
+		SceneConfig scene = config;
+		SweepRun run;
+		run.Combination = combination;
+		for (int a = 0; a < axes.size(); a++)
+		{
+			if (!scene.set(axes[a].first, axes[a].second[index[a]])) return false;
+			const JsonValue& value = axes[a].second[index[a]];
+			run.Values.push_back(value.Type == JsonValue::JSON_STRING ? value.String : writeJson(value));
+		}
+		run.TimeStep = scene.TimeStep;
+		run.Frames = scene.TotalFrame;
+		run.ClothIndex = 0;
+		for (ClothConfig& cloth : scene.Cloths)
+		{
+			for (int i = 0; i < cloth.Count; i++, run.ClothIndex++)
+			{
+				run.Cloth = cloth;
+				run.Position = cloth.Position + cloth.Spacing * (float)i;
+				runs.push_back(run);
+			}
+		}
+		// next combination, the last key changes fastest
+		int a = (int)axes.size() - 1;
+		while (a >= 0 && ++index[a] == axes[a].second.size()) index[a--] = 0;
+		if (a < 0) break;
+	}
+
+	FILE* file = fopen(config.Output.c_str(), "w");
+	if (file == NULL)
+	{
+		printf("Can't write the sweep results to %s\n", config.Output.c_str());
+		return false;
+	}
+	printf("Sweep of %zu runs on %d threads, %d frames each\n", runs.size(), threadPool.getThreadCount(), config.TotalFrame);
+	std::chrono::steady_clock::time_point sweepBegin = std::chrono::steady_clock::now();
+	threadPool.ParallelFor(0, (int)runs.size(), [&](int r)
+	{
+		SweepRun& run = runs[r];
+		Cloth cloth(run.Position, run.Cloth.Size, run.Cloth.Method, run.Cloth.Material);
+		cloth.UpdateVelocity(VEL_BACK, Cloth::DEFAULT_FORCE * 0.02); // the push every scene starts with
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		for (int frame = 0; frame < run.Frames; frame++) cloth.Step(run.TimeStep);
+		run.FrameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / run.Frames;
+		run.StretchError = cloth.getStretchError();
+		run.RmsResidual = cloth.Stats.RmsResidual;
+		run.MaxResidual = cloth.Stats.MaxResidual;
+		run.AverageIterations = cloth.Stats.getAverageIterations();
+		run.AverageCoarseIterations = cloth.Stats.getAverageCoarseIterations();
+		run.KineticEnergy = cloth.getKineticEnergy();
+		run.PotentialEnergy = cloth.getPotentialEnergy();
+	}, 1);
+	double sweepTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - sweepBegin).count();
+
+	fprintf(file, "combination,cloth");
+	for (std::pair<std::string, std::vector<JsonValue>>& axis : axes) fprintf(file, ",%s", csvField(axis.first).c_str());
+	fprintf(file, ",preset,nodes_in_width,nodes_in_height,max_iterations,time_step,frame_count,ms_per_frame,stretch_error,rms_residual,max_residual,"
+		"average_iterations,average_coarse_iterations,kinetic_energy,potential_energy\n");
+	int unstable = 0;
+	for (SweepRun& run : runs)
+	{
+		fprintf(file, "%d,%d", run.Combination, run.ClothIndex);
+		for (std::string& value : run.Values) fprintf(file, ",%s", csvField(value).c_str());
+		fprintf(file, ",%s,%d,%d,%d,%.10g,%d,%.4f,%.6e,%.6e,%.6e,%.3f,%.3f,%.6e,%.6e\n", run.Cloth.Method.getName().c_str(),
+			(int)run.Cloth.Method.MethodClothNodesNumber.x, (int)run.Cloth.Method.MethodClothNodesNumber.y, run.Cloth.Method.MethodIteration,
+			run.TimeStep, run.Frames, run.FrameTime, run.StretchError, run.RmsResidual, run.MaxResidual, run.AverageIterations, run.AverageCoarseIterations,
+			run.KineticEnergy, run.PotentialEnergy);
+		if (!std::isfinite(run.KineticEnergy) || !std::isfinite(run.StretchError)) unstable++;
+	}
+	fclose(file);
+	printf("%zu runs in %.2f s written to %s", runs.size(), sweepTime, config.Output.c_str());
+	if (unstable > 0) printf(", %d of them exploded (not finite)", unstable);
+	printf("\n");
+	return true;
+}
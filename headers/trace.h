@@ -0,0 +1,142 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <stdio.h>
+#include "perfcounter.h"
+
+// Timeline of the frames for chrome://tracing or https://ui.perfetto.dev, enabled with --trace <file>.
+// TRACE_SCOPE(name) records one complete event from the line to the end of the scope. Every thread
+// appends to its own buffer, so recording takes no lock; the lock is only taken the first time a
+// thread records, to register its buffer. Disabled, a scope costs one branch.
+struct TraceEvent
+{
+	const char* Name; // a string literal, never freed
+	long long Begin;  // ns since Tracer::start
+	long long End;
+};
+
+class Tracer
+{
+public:
+	bool Enabled = false;
+
+	void start()
+	{
+		Origin = std::chrono::steady_clock::now();
+		Enabled = true;
+	}
+
+	long long now() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Origin).count(); }
+
+	void record(const char* name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+	{
+		record(name, std::chrono::duration_cast<std::chrono::nanoseconds>(begin - Origin).count(),
+			std::chrono::duration_cast<std::chrono::nanoseconds>(end - Origin).count());
+	}
+
+	void record(const char* name, long long begin, long long end)
+	{
+		ThreadBuffer& buffer = threadBuffer();
+		if (buffer.Events.size() < MAX_EVENTS_PER_THREAD) buffer.Events.push_back({ name, begin, end });
+		else buffer.Dropped++;
+	}
+
+	// shown as the name of the calling thread's row in the timeline
+	void setThreadName(const std::string& name) { threadBuffer().Name = name; }
+
+	// Chrome trace event format, the events of every thread as complete ("X") events in microseconds.
+	// Call it when no other thread records any more, e.g. at exit while the workers wait for a job.
+	bool write(const std::string& path)
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (file == NULL)
+		{
+			printf("Can't write the trace to %s\n", path.c_str());
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(RegisterMutex);
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		bool first = true;
+		long long events = 0, dropped = 0;
+		for (std::unique_ptr<ThreadBuffer>& buffer : Buffers)
+		{
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",\n", buffer->Id, buffer->Name.c_str());
+			first = false;
+			for (TraceEvent& event : buffer->Events)
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					event.Name, buffer->Id, event.Begin / 1000.0, (event.End - event.Begin) / 1000.0);
+			events += buffer->Events.size();
+			dropped += buffer->Dropped;
+		}
+		fprintf(file, "\n]}\n");
+		fclose(file);
+		printf("Trace of %lld events written to %s", events, path.c_str());
+		if (dropped > 0) printf(", %lld events dropped over the limit of %zu per thread", dropped, MAX_EVENTS_PER_THREAD);
+		printf("\n");
+		return true;
+	}
+
+private:
+	static const size_t MAX_EVENTS_PER_THREAD = 1 << 22; // 96 MiB per thread
+
+	struct ThreadBuffer
+	{
+		int Id;
+		std::string Name;
+		std::vector<TraceEvent> Events;
+		long long Dropped = 0;
+	};
+
+	std::chrono::steady_clock::time_point Origin = std::chrono::steady_clock::now();
+	std::mutex RegisterMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> Buffers;
+
+	ThreadBuffer& threadBuffer()
+	{
+		static thread_local ThreadBuffer* buffer = nullptr;
+		if (buffer == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(RegisterMutex);
+			Buffers.emplace_back(new ThreadBuffer());
+			buffer = Buffers.back().get();
+			buffer->Id = (int)Buffers.size() - 1;
+			buffer->Name = "thread " + std::to_string(buffer->Id);
+		}
+		return *buffer;
+	}
+};
+Tracer tracer;
+
+// A scope is also a phase of the hardware counters when perfPhases is started (see perfcounter.h)
+class TraceScope
+{
+public:
+	TraceScope(const char* name) : Name(name), Begin(tracer.Enabled ? tracer.now() : -1), Counted(perfPhases.isCounted())
+	{
+		if (Counted) perfPhases.Counters.read(CounterBegin);
+	}
+	~TraceScope()
+	{
+		if (Counted)
+		{
+			long long counterEnd[PERF_COUNTER_NUMBER];
+			perfPhases.Counters.read(counterEnd);
+			perfPhases.add(Name, CounterBegin, counterEnd);
+		}
+		if (Begin >= 0) tracer.record(Name, Begin, tracer.now());
+	}
+
+private:
+	const char* Name;
+	long long Begin;
+	bool Counted;
+	long long CounterBegin[PERF_COUNTER_NUMBER];
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
@@ -9,6 +9,11 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H  
 #include "headers/renderer.h"
+#include "headers/scene.h"
+#include "headers/benchmark.h"
+#include "headers/hud.h"
+#include "headers/config.h"
+#include "headers/sweep.h"
 #if __has_include(<FreeImage.h>)
 #define FREEIMAGE
 #include <FreeImage.h>
@@ -17,25 +22,22 @@
 /** constant variable **/
 // WIDTH and HEIGHT are set in renderer.h
 const glm::vec3 backgroundColor(50.0 / 255, 50.0 / 255, 60.0 / 255);
-const glm::vec3 ClothPosition(-8, 9, -4);
-const glm::vec2 ClothSize(16, 16);
-const int TOTAL_FRAME = 1000; // used for certain frame simulation
-const bool Record = false; // true means after TOTAL_FRAME, the simulation will stop immediately
-const bool showTime = false; // whether to show time on the left up corner
 const float FONT_SIZE = 25;  // displayed UI font size
 const int GLFW_INTERVAL = 0; // set interval if needed
 /** end of constant variable **/
 
 /** global variable **/
+SceneConfig config; // cloths, time step, frames and output options, see config.h
 double TIME_STEP = 1.0 / 60.0;
 MethodClass Method = M_PPBD;
-int isRunning = Record ? TOTAL_FRAME : 0;
+int isRunning = 0;
 int simulationFrame = -1;
 glm::vec2 ClothNodesNumber = Method.MethodClothNodesNumber;
 int ClothIteration = Method.MethodIteration;
-Cloth cloth;
+Scene scene;
 ClothRenderer clothRenderer;
 TextRenderer textRenderer;
+PerformanceHUD hud;
 std::string RECORD_SAVE_PATH = ((std::filesystem::path)std::filesystem::current_path()).string() + "\\exp\\";
 std::string TEXT_SAVE_PATH = ((std::filesystem::path)std::filesystem::current_path()).string() + "\\text\\";
 int photoCount = 1;
@@ -53,8 +55,43 @@ void methodInput();
 
 int main(int argc, const char* argv[]) 
 {
-    // deal with input
-    methodInput();
+    // --scene <file>, --set key=value and their short forms, see config.h
+    if (!config.parseArguments(argc, argv)) return -1;
+    // the counters only follow the main thread, so the counter benchmark runs without workers unless --threads is given
+    if (config.Threads == -1 && config.Benchmark == "counters") config.Threads = 1;
+    if (config.Threads != -1) threadPool.setThreadCount(config.Threads);
+    tracer.setThreadName("main");
+    if (!config.TracePath.empty()) tracer.start();
+
+    // headless comparison of the node and constraint orders, or with "counters" the hardware counters of every phase, see benchmark.h
+    if (!config.Benchmark.empty())
+    {
+        if (config.Benchmark == "counters") RunCounterBenchmark();
+        else RunLocalityBenchmark();
+        return 0;
+    }
+
+    // headless runs of every combination of the --sweep values, see sweep.h
+    if (!config.Sweep.empty())
+    {
+        bool swept = RunParameterSweep(config);
+        if (!config.TracePath.empty()) tracer.write(config.TracePath);
+        return swept ? 0 : -1;
+    }
+
+    // deal with input, the method is only asked for without a scene file or options
+    if (config.Configured)
+    {
+        Method = config.Cloths[0].Method;
+        TIME_STEP = config.TimeStep;
+    }
+    else
+    {
+        methodInput();
+        config.Cloths[0].Method = Method;
+        config.TimeStep = TIME_STEP;
+    }
+    isRunning = config.Record ? config.TotalFrame : 0;
 
     // Prepare for rendering
     printf("******************************\n");
@@ -88,16 +125,18 @@ int main(int argc, const char* argv[])
     printf("******************************\n");
 
     // set camera to appropriate position
-    if (!showTime)
+    if (!config.ShowTime)
     {
         camera.Zoom = 40.0f;
     }
 
     Init();
+    scene.enableLOD(config.UseLOD);
     printf("******************************\n");
     printf("Building shaders...\n");
-    clothRenderer.init(&cloth);
+    clothRenderer.init(scene.Cloths);
     textRenderer.init(FONT_SIZE);
+    hud.init();
     printf("Shaders built with no error.\n");
     printf("******************************\n");
 
@@ -106,48 +145,41 @@ int main(int argc, const char* argv[])
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glPointSize(3); 
 
-    std::string outputFrameTime, outputTotalTime;
-    GLdouble subTimeStep = TIME_STEP / cloth.Iteration;
+    std::string outputFrameTime, outputTotalTime, outputResidual;
+    double solverTime = 0.0; // ms of scene.Step in the last simulated frame
     float currentFrame, lastFrame, deltaTime; // count every frame time
     float beginTime = static_cast<float>(glfwGetTime()), endTime, averageTime; // count total simulation time
     glfwSwapInterval(GLFW_INTERVAL);
-    cloth.UpdateVelocity(VEL_BACK, cloth.DEFAULT_FORCE * 0.02);
+    scene.UpdateVelocity(VEL_BACK, Cloth::DEFAULT_FORCE * 0.02);
     while (!glfwWindowShouldClose(window)) 
     {
+        TRACE_SCOPE("frame");
         /** per-frame time logic **/
         glClearColor(backgroundColor.x, backgroundColor.y, backgroundColor.z, 1.0);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        if (showTime)
+        if (config.ShowTime)
             lastFrame = static_cast<float>(glfwGetTime());  
         /** end of per-frame time logic **/
         
         /** simulating & rendering **/
         if (isRunning)
         {
-            //cloth.UpdateVelocity(VEL_BACK, cloth.DEFAULT_FORCE * 0.05);
-            //cloth.UpdateVelocity(VEL_DOWN, cloth.DEFAULT_FORCE * 0.05);
-            switch (Method.getId())
-            {
-                case XPBD_SS:
-                    for (int subStep = 0; subStep < cloth.Iteration; subStep++) 
-                    {
-                        cloth.Integrate(subTimeStep);
-                    }
-                    break;
-                default:
-                    cloth.Integrate(TIME_STEP);
-                    break;
-            }
-            cloth.computeNormal();
+            //scene.UpdateVelocity(VEL_BACK, Cloth::DEFAULT_FORCE * 0.05);
+            //scene.UpdateVelocity(VEL_DOWN, Cloth::DEFAULT_FORCE * 0.05);
+            scene.UpdateLOD(camera, HEIGHT);
+            double solverBegin = glfwGetTime();
+            scene.Step(TIME_STEP);
+            solverTime = (glfwGetTime() - solverBegin) * 1000.0;
             simulationFrame++;
         }
 
         clothRenderer.render();
+        if (isRunning) hud.record(solverTime, clothRenderer.Stats, scene.getWorstStats(), scene.getNodeCount(), (int)scene.Cloths.size());
         /** end of simulating & rendering **/
         
         /** post-frame time logic **/
         /** display time**/
-        if (showTime)
+        if (config.ShowTime)
         {
             currentFrame = static_cast<float>(glfwGetTime());
             deltaTime = currentFrame - lastFrame;
@@ -158,18 +190,41 @@ int main(int argc, const char* argv[])
                 for (int i = 0; i < 4; i++) outputFrameTime.pop_back(); // only display 2 precision
                 outputFrameTime += " ms per frame";
             }
-            textRenderer.RenderText(outputFrameTime, 25.0f, HEIGHT - 40.0f, 1.0f, glm::vec3(1.0f, 1.0f, 1.0f));
+            textRenderer.AddText(outputFrameTime, 25.0f, HEIGHT - 40.0f, 1.0f, glm::vec3(1.0f, 1.0f, 1.0f));
             endTime = static_cast<float>(glfwGetTime());
             outputTotalTime = std::to_string(endTime);
             for (int i = 0; i < 4; i++) outputTotalTime.pop_back(); // only display 2 precision
             outputTotalTime += "s in total.";
-            textRenderer.RenderText(outputTotalTime, 25.0f, HEIGHT - 80.0f, 1.0f, glm::vec3(1.0f, 1.0f, 1.0f));
+            textRenderer.AddText(outputTotalTime, 25.0f, HEIGHT - 80.0f, 1.0f, glm::vec3(1.0f, 1.0f, 1.0f));
+            if (!Method.isMassSpring())
+            {
+                char residual[64];
+                SolverStats worst = scene.getWorstStats(); // of the slowest cloth, like the HUD
+                snprintf(residual, sizeof(residual), "%d iterations, residual %.2e", worst.Iterations, worst.RmsResidual);
+                outputResidual = residual;
+                textRenderer.AddText(outputResidual, 25.0f, HEIGHT - 120.0f, 1.0f, glm::vec3(1.0f, 1.0f, 1.0f));
+            }
+            textRenderer.Flush(); // the whole overlay in one draw call
+        }
+        {
+            TRACE_SCOPE("overlay");
+            hud.render(textRenderer);
         }
-        if (Record && isRunning == 0)
+        if (config.Record && isRunning == 0)
         {
             endTime = static_cast<float>(glfwGetTime());
-            averageTime = (endTime - beginTime) / TOTAL_FRAME;
-            printf("The total simulation time of %d frames is: %.2f ms, average time per frame is: %.2f ms\n", TOTAL_FRAME, (endTime - beginTime) * 1000, averageTime * 1000);
+            averageTime = (endTime - beginTime) / config.TotalFrame;
+            printf("The total simulation time of %d frames is: %.2f ms, average time per frame is: %.2f ms\n", config.TotalFrame, (endTime - beginTime) * 1000, averageTime * 1000);
+            if (!Method.isMassSpring())
+            {
+                for (int i = 0; i < scene.Cloths.size(); i++)
+                {
+                    Cloth* cloth = scene.Cloths[i];
+                    printf("Cloth %d (%s): average constraint iterations per frame: %.2f\n", i, cloth->Method.getName().c_str(), cloth->Stats.getAverageIterations());
+                    if (cloth->Method.HierarchyLevels > 0 && cloth->Method.usesHierarchy())
+                        printf("Cloth %d: average coarse hierarchy work per frame: %.2f iterations\n", i, cloth->Stats.getAverageCoarseIterations());
+                }
+            }
             //savePicture();
             break;
         }
@@ -178,9 +233,13 @@ int main(int argc, const char* argv[])
         if (isRunning > 0) isRunning--;
         /* end of post-frame time logic **/
 
-        glfwSwapBuffers(window);
+        {
+            TRACE_SCOPE("swap buffers"); // waits for the GPU and the vertical sync
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents(); // Update the status of window
     }
+    if (!config.TracePath.empty()) tracer.write(config.TracePath);
     glfwTerminate();
 	return 0;
 }
@@ -190,7 +249,9 @@ void Init()
     printf("******************************\n");
     printf("Initializing the cloth...\n");
     printf("");
-    cloth.set(ClothPosition, ClothSize, Method);
+    for (ClothConfig& cloth : config.Cloths)
+        for (int i = 0; i < cloth.Count; i++)
+            scene.Add(cloth.Position + cloth.Spacing * (float)i, cloth.Size, cloth.Method, cloth.Material);
     printf("Cloth initialized with no error.\n");
     printf("******************************\n");
 }
@@ -238,13 +299,47 @@ void keyCallBack(GLFWwindow* window, int key, int scancode, int action, int mods
 
         // Z, X, C: switch display mode
         case GLFW_KEY_Z:
-            cloth.drawMode = Cloth::DRAW_NODES;
+            scene.setDrawMode(Cloth::DRAW_NODES);
             break;
         case GLFW_KEY_X:
-            cloth.drawMode = Cloth::DRAW_LINES;
+            scene.setDrawMode(Cloth::DRAW_LINES);
             break;
         case GLFW_KEY_C:
-            cloth.drawMode = Cloth::DRAW_FACES;
+            scene.setDrawMode(Cloth::DRAW_FACES);
+            break;
+
+        // L: switch level of detail
+        case GLFW_KEY_L:
+            if (action == GLFW_PRESS)
+            {
+                scene.enableLOD(scene.LODs.empty());
+                std::cout << (scene.LODs.empty() ? "Level of detail disabled." : "Level of detail enabled.") << std::endl;
+            }
+            break;
+
+        // G: switch the normal source, CPU -> GPU smooth -> GPU flat
+        case GLFW_KEY_G:
+            if (action == GLFW_PRESS)
+            {
+                const char* names[3] = { "CPU", "GPU smooth", "GPU flat" };
+                clothRenderer.setNormalMode((ClothRenderer::NormalModeEnum)((clothRenderer.NormalMode + 1) % 3));
+                std::cout << "Normals: " << names[clothRenderer.NormalMode] << std::endl;
+            }
+            break;
+
+        // V: switch between the float and the compact (quantized) vertex stream
+        case GLFW_KEY_V:
+            if (action == GLFW_PRESS)
+            {
+                clothRenderer.setCompactVertices(!clothRenderer.CompactVertices);
+                std::cout << (clothRenderer.CompactVertices ? "Compact vertices." : "Float vertices.") << std::endl;
+            }
+            break;
+
+        // H: show/hide the performance graphs
+        case GLFW_KEY_H:
+            if (action == GLFW_PRESS)
+                hud.Visible = !hud.Visible;
             break;
 
         // W, S, A, D: move camera
@@ -265,13 +360,12 @@ void keyCallBack(GLFWwindow* window, int key, int scancode, int action, int mods
         case GLFW_KEY_R:
             if (action == GLFW_PRESS)
             {
-                cloth.reset();
-                cloth.UpdateVelocity(VEL_BACK, cloth.DEFAULT_FORCE * 0.02);
+                scene.reset();
+                scene.UpdateVelocity(VEL_BACK, Cloth::DEFAULT_FORCE * 0.02);
                 simulationFrame = 1;
-                if (!Record)
+                if (!config.Record)
                 {
                     isRunning = 0;
-                    clothRenderer.ClothObject = &cloth;
                     glClearColor(backgroundColor.x, backgroundColor.y, backgroundColor.z, 1.0);
                     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
                     clothRenderer.render();
@@ -279,26 +373,26 @@ void keyCallBack(GLFWwindow* window, int key, int scancode, int action, int mods
                     glfwPollEvents();
                 }
                 else
-                    isRunning = TOTAL_FRAME;
+                    isRunning = config.TotalFrame;
             }
             break;
 
         // up, down, left and right will pull the cloth with certain force.
         case GLFW_KEY_UP:
             if (action == GLFW_PRESS)
-                cloth.UpdateVelocity(VEL_FRONT);
+                scene.UpdateVelocity(VEL_FRONT);
             break;
         case GLFW_KEY_DOWN:
             if (action == GLFW_PRESS)
-                cloth.UpdateVelocity(VEL_BACK);
+                scene.UpdateVelocity(VEL_BACK);
             break;
         case GLFW_KEY_LEFT:
             if (action == GLFW_PRESS)
-                cloth.UpdateVelocity(VEL_LEFT_AND_UP);
+                scene.UpdateVelocity(VEL_LEFT_AND_UP);
             break;
         case GLFW_KEY_RIGHT:
             if (action == GLFW_PRESS)
-                cloth.UpdateVelocity(VEL_RIGHT_AND_UP);
+                scene.UpdateVelocity(VEL_RIGHT_AND_UP);
             break;
         case GLFW_KEY_N:
             if (action == GLFW_RELEASE) {
@@ -309,16 +403,21 @@ void keyCallBack(GLFWwindow* window, int key, int scancode, int action, int mods
                 if (!std::filesystem::exists(folderPath))
                     std::filesystem::create_directory(folderPath);
                 folderPath += "/dt=" + std::to_string((int)round(1 / TIME_STEP));
-                folderPath += " iteration=" + std::to_string(cloth.Iteration);
+                folderPath += " iteration=" + std::to_string(Method.MethodIteration);
                 if (!std::filesystem::exists(folderPath))
                     std::filesystem::create_directory(folderPath);
-                std::string textPrefix = "/" + Method.getName() + " dt=" + std::to_string((int)round(1 / TIME_STEP)) + " iteration=" + std::to_string(cloth.Iteration);
+                std::string textPrefix = "/" + Method.getName() + " dt=" + std::to_string((int)round(1 / TIME_STEP)) + " iteration=" + std::to_string(Method.MethodIteration);
                 std::string photoName = folderPath + textPrefix + " " + std::to_string(simulationFrame) + ".txt";
                 std::ofstream clothFile;
                 clothFile.open(photoName);
-                clothFile << "Nodes Position: " << std::endl;
-                for (Node* node : cloth.Nodes) {
-                    clothFile << node->Position.x << " " << node->Position.y << " " << node->Position.z << std::endl;
+                for (Cloth* cloth : scene.Cloths) {
+                    clothFile << "Nodes Position: " << std::endl;
+                    for (int h = 0; h < cloth->NodesInHeight; h++) {
+                        for (int w = 0; w < cloth->NodesInWidth; w++) {
+                            Node* node = cloth->getNode(w, h);
+                            clothFile << node->Position.x << " " << node->Position.y << " " << node->Position.z << std::endl;
+                        }
+                    }
                 }
                 clothFile.close();
             }
@@ -353,10 +452,10 @@ void savePicture()
     if (!std::filesystem::exists(folderPath))
         std::filesystem::create_directory(folderPath);
     folderPath += "/dt=" + std::to_string((int)round(1 / TIME_STEP));
-    folderPath += " iteration=" + std::to_string(cloth.Iteration);
+    folderPath += " iteration=" + std::to_string(Method.MethodIteration);
     if (!std::filesystem::exists(folderPath))
         std::filesystem::create_directory(folderPath);
-    std::string photoPrefix = "/" + Method.getName() + " dt=" + std::to_string((int)round(1 / TIME_STEP)) + " iteration=" + std::to_string(cloth.Iteration);
+    std::string photoPrefix = "/" + Method.getName() + " dt=" + std::to_string((int)round(1 / TIME_STEP)) + " iteration=" + std::to_string(Method.MethodIteration);
     std::string photoName = folderPath + photoPrefix + " " + std::to_string(photoCount) + ".png";
     FreeImage_Save(FIF_PNG, image, photoName.c_str(), 0);
     std::cout << "Save screenshot as " + photoName << std::endl;
@@ -373,6 +472,17 @@ void methodInput() {
     printf("4. Verlet_Intergration with iteration = 40.\n");
     printf("5. Explicit_Euler with iteration = 100.\n");
     printf("6. Semi_Implicit_Euler with iteration = 40.\n");
+    printf("7. XPBD_Hierarchy method with iteration = 4.\n");
+    printf("8. XPBD_SOR method with iteration = 8.\n");
+    printf("9. XPBD_Chebyshev method with iteration = 6.\n");
+    printf("10. XPBD_Jacobi method with iteration = 20.\n");
+    printf("11. XPBD_Adaptive method with iteration = 1 to 10.\n");
+    printf("12. Implicit_Euler with at most 50 conjugate gradient iterations.\n");
+    printf("13. Projective_Dynamics with 3 local/global iterations.\n");
+    printf("14. Vertex_Block_Descent with iteration = 10.\n");
+    printf("15. XPBD_Tether method with iteration = 4.\n");
+    printf("16. XPBD_Isometric_Bending method with iteration = 10.\n");
+    printf("17. XPBD_Strain_Membrane method with iteration = 10.\n");
     printf("Enter the method number: ");
     int inputMethodNum = -1;
     std::cin >> inputMethodNum;
@@ -396,6 +506,39 @@ void methodInput() {
     case 6:
         Method = M_Semi_Implicit_Euler;
         break;
+    case 7:
+        Method = M_PPBD_Hierarchy;
+        break;
+    case 8:
+        Method = M_PPBD_SOR;
+        break;
+    case 9:
+        Method = M_PPBD_Chebyshev;
+        break;
+    case 10:
+        Method = M_PPBD_Jacobi;
+        break;
+    case 11:
+        Method = M_PPBD_Adaptive;
+        break;
+    case 12:
+        Method = M_Implicit_Euler;
+        break;
+    case 13:
+        Method = M_Projective_Dynamics;
+        break;
+    case 14:
+        Method = M_Vertex_Block_Descent;
+        break;
+    case 15:
+        Method = M_PPBD_Tether;
+        break;
+    case 16:
+        Method = M_PPBD_Isometric;
+        break;
+    case 17:
+        Method = M_PPBD_Strain;
+        break;
     Default:
         Method = M_PPBD_SS;
         break;
@@ -13,15 +13,26 @@ uniform sampler2D Texture2;
 uniform vec3 lightPosition;
 uniform vec3 lightColor;
 
+uniform int normalMode; // see cloth.vs
+
 void main()
 {
     // Ambient
     float ambientStrength = 0.5f;
     vec3 ambient = ambientStrength * lightColor;
 
+    // Flat: the derivatives of the position lie in the plane of the face, their cross product faces the viewer,
+    // so it is flipped on back faces to point the way of the winding like the smooth normals.
+    vec3 n = normal;
+    if (normalMode == 2)
+    {
+        n = normalize(cross(dFdx(position), dFdy(position)));
+        if (!gl_FrontFacing) n = -n;
+    }
+
     // Diffuse
     vec3 lightDir = normalize(lightPosition - position);
-    float diff = max(dot(normal, lightDir), 0.0);
+    float diff = max(dot(n, lightDir), 0.0);
     vec3 diffuse = diff * lightColor;
 
     // texture() will output the color obtained by sampling the texture with configured conditions
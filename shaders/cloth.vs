@@ -2,6 +2,8 @@
 layout (location = 0) in vec3 vsPosition;
 layout (location = 1) in vec2 vsTexCoord;
 layout (location = 2) in vec3 vsNormal;
+layout (location = 3) in uvec4 vsGrid; // w, h, nodes in width, nodes in height
+layout (location = 4) in uint vsCloth;
 
 out vec3 position;
 out vec2 texCoord;
@@ -11,10 +13,64 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// 0: vsNormal from the CPU, 1: gathered here from the neighbours, 2: per face in the fragment shader
+uniform int normalMode;
+// all the vertex positions as single components, vertex i is at 3 * i
+uniform samplerBuffer positions;
+
+// Compact stream: vsPosition is normalized in the bounding box of its cloth and vsNormal.xy is octahedron encoded
+uniform bool compactVertices;
+uniform samplerBuffer boxes; // minimum and size of the bounding box of every cloth
+vec3 boxMinimum, boxSize;
+
+vec3 decodePosition(vec3 stored)
+{
+    return compactVertices ? boxMinimum + stored * boxSize : stored;
+}
+
+vec3 decodeOctahedron(vec2 e)
+{
+    vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    if (n.z < 0.0f) n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+    return normalize(n);
+}
+
+vec3 fetchPosition(int vertex)
+{
+    return decodePosition(vec3(texelFetch(positions, 3 * vertex).r, texelFetch(positions, 3 * vertex + 1).r, texelFetch(positions, 3 * vertex + 2).r));
+}
+
+// Same as Cloth::computeNormal: the faces around a node are the ring E, S, SW, W, N, NE of its neighbours,
+// only the faces whose two ring neighbours exist are summed. The vertices of a cloth are in grid order,
+// so the neighbour (w + dw, h + dh) is vertex gl_VertexID + dh * width + dw (gl_VertexID includes the base vertex).
+vec3 gatherNormal(vec3 center)
+{
+    const ivec2 ring[6] = ivec2[6](ivec2(1, 0), ivec2(0, 1), ivec2(-1, 1), ivec2(-1, 0), ivec2(0, -1), ivec2(1, -1));
+    ivec2 grid = ivec2(vsGrid.xy), size = ivec2(vsGrid.zw);
+    vec3 edge[6];
+    bool inside[6];
+    for (int k = 0; k < 6; k++)
+    {
+        ivec2 neighbour = grid + ring[k];
+        inside[k] = all(greaterThanEqual(neighbour, ivec2(0))) && all(lessThan(neighbour, size));
+        edge[k] = inside[k] ? fetchPosition(gl_VertexID + ring[k].y * size.x + ring[k].x) - center : vec3(0.0f);
+    }
+    vec3 sum = vec3(0.0f);
+    for (int k = 0; k < 6; k++)
+        if (inside[k] && inside[(k + 1) % 6]) sum += cross(edge[k], edge[(k + 1) % 6]);
+    return normalize(sum);
+}
+
 void main()
 {
-    position = vsPosition;
-    normal = vsNormal;
-    gl_Position = projection * view * model * vec4(vsPosition, 1.0f);
+    if (compactVertices)
+    {
+        boxMinimum = texelFetch(boxes, 2 * int(vsCloth)).xyz;
+        boxSize = texelFetch(boxes, 2 * int(vsCloth) + 1).xyz;
+    }
+    position = decodePosition(vsPosition);
+    if (normalMode == 1) normal = gatherNormal(position);
+    else normal = compactVertices ? decodeOctahedron(vsNormal.xy) : vsNormal;
+    gl_Position = projection * view * model * vec4(position, 1.0f);
     texCoord = vec2(vsTexCoord.x, vsTexCoord.y);
-}
\ No newline at end of file
+}